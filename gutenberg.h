@@ -0,0 +1,145 @@
+/*
+ * This file describes the shared memory segments that shm_init
+ * builds and the search programs read.
+ *
+ * "/gutenberg" holds the text.  Each kept line of each file is
+ * copied in with CRs removed and its LF replaced by a null, and
+ * DATAPAD zero bytes follow the last line so the searchers can
+ * load past the end without checking.
+ *
+ * "/gutenberg.prov" says which files each part of "/gutenberg"
+ * came from.  It starts with a provhdr, followed by the file
+ * names (MAXNAMELEN bytes each, as in the filelist), the table of
+ * runs sorted by offset and the table of file references.  A run
+ * covers "/gutenberg" from its offset up to the next run's offset.
+ * Without duplicate removal there is one run per file.  With it, a
+ * line that was found in several files gets a run of its own that
+ * lists all of them.
+ *
+ * "/gutenberg.lines" is the line index.  It holds a lineshdr followed
+ * by a lineent for every line of "/gutenberg" that is not empty, in
+ * data set order.  With it the searchers find the lines they need
+ * without looking for the nulls, and pass over the lines that are too
+ * short for the substring length without touching them.
+ *
+ * "/gutenberg.soa" is an optional second copy of "/gutenberg" (shm_init
+ * -s) cut into SOASTREAMS streams of 'step' bytes, stream s starting
+ * at byte s * step, with their 32 bit words interleaved: after the
+ * soahdr comes row 0, which is word 0 of each stream in stream order,
+ * then row 1 and so on.  A vector load of part of a row gives the same
+ * word of several streams, so the searchers hash one substring from
+ * each stream at a time without spreading the bytes out.  Each stream
+ * runs on for SOAPAD bytes into the next one, so that a substring
+ * starting in the last bytes of a stream is whole, and past the end
+ * of the data set reads as zeros.
+ *
+ * "/gutenberg.manifest" records what shm_init loaded so that it can
+ * later load just the files that are new or have changed (-u).  It
+ * holds a manifesthdr followed by one manifestent per file in the
+ * filelist, in filelist order.  The files' lines are not always in
+ * filelist order in "/gutenberg": an update appends the new and
+ * changed files after the old data and zeroes the bytes of the
+ * changed and vanished ones, which the searchers then see as empty
+ * lines.  The manifest is removed while an update is in progress.
+ *
+ * "/gutenberg.stats.<pid>" is written by a running shm_vec_md5 so a
+ * monitor can watch it.  It holds a statshdr followed by one statslot
+ * per thread.  Each slot has a single writer and takes a cache line of
+ * its own.  The counters only go up, and the header's 'updated' time
+ * is refreshed every progress report.
+ */
+
+#ifndef GUTENBERG_H
+#define GUTENBERG_H
+
+#include <stdint.h>
+
+#define MAXNAMELEN  512     /* length of each name in the filelist */
+#define DATAPAD     100     /* zero bytes after the data set */
+#define PROVSHM     "/gutenberg.prov"
+#define PROVMAGIC   0x766f7270  /* "prov" */
+
+struct provhdr {
+    uint32_t    magic;      // PROVMAGIC
+    uint32_t    nfiles;     // number of file names
+    uint64_t    datalen;    // length of "/gutenberg" without the pad
+    uint64_t    nruns;      // number of entries in the run table
+    uint64_t    nrefs;      // number of entries in the reference table
+};
+
+struct provrun {
+    uint64_t    offset;     // where the run starts in "/gutenberg"
+    uint32_t    ref;        // index of its first file in the reference table
+    uint32_t    nref;       // number of files it came from
+};
+
+#define LINESHM     "/gutenberg.lines"
+#define LINESMAGIC  0x656e696c  /* "line" */
+
+struct lineshdr {
+    uint32_t    magic;      // LINESMAGIC
+    uint32_t    minlen;     // shm_init dropped the lines shorter than this
+    uint64_t    datalen;    // length of "/gutenberg" without the pad
+    uint64_t    nlines;     // number of lineents that follow
+};
+
+struct lineent {
+    uint32_t    offset;     // where the line starts in "/gutenberg"
+    uint32_t    len;        // its length, not counting the null after it
+};
+
+#define SOASHM      "/gutenberg.soa"
+#define SOAMAGIC    0x20616f73  /* "soa " */
+#define SOASTREAMS  16      /* streams in the interleaved copy */
+#define SOAPAD      64      /* bytes each stream runs on into the next */
+
+struct soahdr {
+    uint32_t    magic;      // SOAMAGIC
+    uint32_t    nstreams;   // SOASTREAMS
+    uint64_t    datalen;    // length of "/gutenberg" without the pad
+    uint64_t    step;       // bytes between stream starts, a multiple of 4
+    uint64_t    nrows;      // rows of SOASTREAMS words that follow
+} __attribute__ ((aligned (64)));
+
+#define MANIFESTSHM "/gutenberg.manifest"
+#define MANIFESTMAGIC 0x666e616d  /* "manf" */
+
+struct manifesthdr {
+    uint32_t    magic;      // MANIFESTMAGIC
+    uint32_t    nfiles;     // number of manifestents that follow
+    uint32_t    sublen;     // substring length the lines were kept for
+    uint32_t    dedup;      // 1 if repeated lines were removed (-d)
+    uint64_t    datalen;    // length of "/gutenberg" without the pad
+    uint64_t    dead;       // bytes of it zeroed by updates
+};
+
+struct manifestent {
+    char        name[MAXNAMELEN]; // the file, as named in the filelist
+    uint64_t    size;       // its size when it was loaded
+    int64_t     mtime;      // and its modification time, ns since the epoch
+    uint64_t    outoff;     // where its lines are in "/gutenberg"
+    uint64_t    outlen;     // and how many bytes they take
+};
+
+#define STATSHM     "/gutenberg.stats.%d"   /* with the searcher's pid */
+#define STATSMAGIC  0x74617473  /* "stat" */
+
+struct statshdr {
+    uint32_t    magic;      // STATSMAGIC
+    uint32_t    nthread;    // number of statslots that follow
+    uint32_t    sublen;     // substring length being searched
+    uint32_t    done;       // set to 1 when the search is over
+    uint64_t    nchunks;    // chunks in the search
+    uint64_t    start;      // when the search started, ns since the epoch
+    uint64_t    updated;    // time of the last progress report, ns since the epoch
+} __attribute__ ((aligned (64)));
+
+struct statslot {
+    uint64_t    hashed;     // substrings hashed
+    uint64_t    bytes;      // bytes of the data set scanned
+    uint64_t    lines;      // line ends passed
+    uint64_t    cycles;     // time stamp counter cycles spent scanning
+    uint64_t    chunks;     // chunks finished
+} __attribute__ ((aligned (64)));
+
+#endif /* GUTENBERG_H */
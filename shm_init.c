@@ -26,11 +26,46 @@
 /*
  * Run this program after getting a copy of the dataset
  * and before running the actual search program.  Invoke as:
- *    shm_init <# char in target string>
+ *    shm_init [-d] [-s] [-u] [# char in target string [# threads]]
+ *
+ * Lines shorter than the target string can hold no match and are
+ * dropped.  Without a length every line of MINSUBLEN characters or
+ * more is kept, and the one load serves a search for any length.
+ *
+ * The files are loaded in parallel.  Each thread mmaps a
+ * file and finds its line ends with SSE2 compares, 64 bytes
+ * at a time.  A first pass works out how many bytes each
+ * file adds to the data set, a prefix sum turns that into
+ * each file's offset, and a second pass copies the files
+ * into place, all threads writing at once.
+ *
+ * The corpus repeats many lines word for word (license text,
+ * headers and the like).  With -d only the first copy of each line
+ * is kept.  The first pass also hashes every kept line, and the
+ * threads then split the hashes between them to find the repeats.
+ * Either way "/gutenberg.prov" is written so the searchers can say
+ * which files a match came from, all of them for a repeated line.
+ *
+ * "/gutenberg.manifest" records the size, modification time and place
+ * in the data set of every file.  With -u only the files that are new
+ * or have changed since then are read.  They are appended to the data
+ * set, which grows in place.  A searcher that has it mapped keeps the
+ * old length, but the old copies of the changed and removed files are
+ * blanked under it.
+ *
+ * Last, "/gutenberg.lines" lists where each line of the data set starts
+ * and how long it is.  The searchers walk it instead of looking for the
+ * nulls and pass over the lines too short for their length.
+ *
+ * With -s "/gutenberg.soa" also gets a copy of the data set cut into
+ * SOASTREAMS streams with their words interleaved (see gutenberg.h).
+ * It costs a second copy of the data, made once, and lets the MD5
+ * searchers get a word of every stream with one aligned vector load
+ * when they are asked to with -S.
  */
 
 /*
- * Build as: gcc -o shm_init shm_init.c  -lrt
+ * Build as: gcc -o shm_init shm_init.c  -lrt -lpthread -O2
  */
 
 
@@ -47,6 +82,8 @@
 #include <string.h>
 #include <strings.h>
 #include <unistd.h>
+#include <emmintrin.h>
+#include "gutenberg.h"
 
 
 
@@ -54,9 +91,41 @@
 //const char *filelist = "/mnt/md5/filelist";
 const char *filelist = "filelist";
 const char *hexdigits = "0123456789abcdef";
-#define MAXNAMELEN 512
 #define DATASETSZ  450000000
-#define MAXLINE    2048
+#define MXTHRD     64        /* Limit the number of threads */
+#define MINSUBLEN  19        /* shortest substring the searchers look for */
+#define MAXSUBLEN  119       /* and the longest */
+#define MAXDEAD    4         /* reload everything once 1/MAXDEAD of the data is dead (-u) */
+
+    /* A kept line of a file, recorded when removing repeated lines */
+typedef struct {
+    uint64_t    hash;       // hash of the line's bytes in the file
+    uint32_t    start;      // offset of the line in the file
+    uint32_t    rawlen;     // length in the file, less any CR before the LF
+    uint32_t    len;        // length with every CR removed
+    int32_t     first;      // line number of the first copy, or -1 if this is it
+} LINEREC;
+
+    /* What we know about each file in the filelist */
+typedef struct {
+    char       *map;        // the file mapped into memory
+    size_t      size;       // size of the file
+    long        outlen;     // bytes the file adds to the data set
+    long        outoff;     // where those bytes go in the data set
+    LINEREC    *lines;      // its kept lines (-d)
+    int         nlines;     // number of entries in lines
+    int         maxlines;   // number of entries allocated for lines
+    int         line0;      // line number of lines[0], counting over all files
+    int64_t     mtime;      // modification time, ns since the epoch
+    int         keep;       // unchanged since the last load, left in place (-u)
+} FILEINFO;
+
+    /* An entry in a hash table of lines, used to find repeated lines */
+typedef struct {
+    uint64_t    hash;       // hash of the line
+    int32_t     file;       // index of the line's file in Files
+    int32_t     k;          // index of the line in that file's lines, or -1 if empty
+} LINESLOT;
 
 
 /************************** GLOBAL VARIABLES ***********************/
@@ -65,10 +134,31 @@ char       *Namearray;      // Location of filelist in our virtual memory
 char       *Dataset;        // All files copied to shared memory
 int         Fdshm;          // FD to opened shared memory segment
 int         Sublen;         // Length of the string to MD5 match
+int         Nthread;        // number of loader threads
+FILEINFO   *Files;          // one entry per file in the filelist
+int         Nextfile;       // next file for a thread to take, taken atomically
+int         Pass;           // 0 to size the files, 1 to copy them
+int         Dedup;          // keep only the first copy of each line (-d)
+int         Nlines;         // number of kept lines in all files (-d)
+int         Update;         // load only new and changed files (-u)
+long        Append;         // where the new files go in the data set (-u)
+long        Dead;           // bytes of the data set zeroed by updates
+struct manifestent **Stale; // entries of the old manifest to zero (-u)
+int         Nstale;         // number of entries in Stale
+int         Soa;            // also write the interleaved copy (-s)
 
 
 /************************* FORWARD REFERENCES **********************/
-void do_files();
+long do_files(int);
+void *do_filethread(void *);
+long do_lines(FILEINFO *, char *);
+void do_dedup();
+void *do_dedupthread(void *);
+void make_prov(long);
+int plan_update();
+void make_manifest(long);
+void make_lines(long);
+void make_soa(long);
 
 
 
@@ -79,12 +169,40 @@ int main(int argc, char *argv[])
     int         *vret;        // generic void pointer return value from a system call
     int          fdfilelist;  // FD to 'filelist'
     struct stat  fileliststat;  // info about filelist
+    long         total;       // bytes in the data set
+    int          opt;         // command line option from getopt()
+    int          nargs;       // arguments after the options
+    int          i;           // generic loop index
 
     /* sanity check */
-    if ((argc !=  2)  ||
-        (sscanf(argv[1], "%d", &Sublen) != 1) ||
-        (Sublen < 19) || (Sublen > 55)) {
-        printf("Usage: %s <substring lenght>\n", argv[0]);
+    Nthread = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (Nthread >= MXTHRD) {
+        Nthread = MXTHRD - 1;
+    }
+    while ((opt = getopt(argc, argv, "dsu")) != -1) {
+        switch (opt) {
+        case 'd':
+            Dedup = 1;
+            break;
+        case 's':
+            Soa = 1;
+            break;
+        case 'u':
+            Update = 1;
+            break;
+        default:
+            printf("Usage: %s [-d] [-s] [-u] [substring lenght [num-threads]]\n", argv[0]);
+            exit(1);
+        }
+    }
+    nargs = argc - optind;
+    Sublen = MINSUBLEN;
+    if ((nargs > 2)  ||
+        ((nargs >= 1) && (sscanf(argv[optind], "%d", &Sublen) != 1)) ||
+        (Sublen < MINSUBLEN) || (Sublen > MAXSUBLEN) ||
+        ((nargs == 2) && (sscanf(argv[optind + 1], "%d", &Nthread) != 1)) ||
+        (Nthread <= 0) || (Nthread >= MXTHRD)) {
+        printf("Usage: %s [-d] [-s] [-u] [substring lenght [num-threads]]\n", argv[0]);
         exit(1);
     }
 
@@ -115,18 +233,53 @@ int main(int argc, char *argv[])
     }
     Namearray = (char *) vret;
 
+    /* Map the files and work out where each one goes */
+    Files = calloc(Nfiles + 1, sizeof(FILEINFO));
+    if (Files == NULL) {
+        printf("Unable to allocate the file table\n");
+        exit(1);
+    }
+    if (Update && (plan_update() == 0)) {
+        Update = 0;
+    }
+    total = do_files(0);
+    if (total > DATASETSZ - DATAPAD) {
+        printf("Out of space in shared memory segment. Exiting...\n");
+        exit(-1);
+    }
+
+    /* The manifest goes until the data set matches it again, so a
+     * load that does not finish is followed by a full one.  The line
+     * index and the interleaved copy go too so no searcher pairs
+     * them with the new data. */
+    (void) shm_unlink(MANIFESTSHM);
+    (void) shm_unlink(LINESHM);
+    (void) shm_unlink(SOASHM);
 
     /* We use the named shared memory segment "/gutenberg".
-     * Try to delete it to clean up any previous run.
-     * Open/create the new /gutenberg. */
-    (void) shm_unlink("/gutenberg");
-    Fdshm = shm_open("/gutenberg", O_RDWR | O_CREAT, 0666);
+     * For a full load try to delete it to clean up any previous
+     * run and open/create the new /gutenberg.  An update grows the
+     * old one.  New space reads as zeros so the pad after the data
+     * needs no clearing. */
+    if (Update) {
+        Fdshm = shm_open("/gutenberg", O_RDWR, 0666);
+    }
+    else {
+        (void) shm_unlink("/gutenberg");
+        Fdshm = shm_open("/gutenberg", O_RDWR | O_CREAT, 0666);
+    }
     if (Fdshm < 0) {
         perror(NULL);
         exit(-1);
     }
+    // Set the length to the data plus the pad
+    ret  = ftruncate(Fdshm, total + DATAPAD);
+    if (ret < 0) {
+        perror(NULL);
+        exit(-1);
+    }
     /* Mamory map the data set */
-    vret = mmap((void *) 0, DATASETSZ, (PROT_READ | PROT_WRITE), MAP_SHARED, Fdshm, 0);
+    vret = mmap((void *) 0, total + DATAPAD, (PROT_READ | PROT_WRITE), MAP_SHARED, Fdshm, 0);
     if (vret < 0) {
         printf("Unable to mmap the data set shared segment\n");
         perror(NULL);
@@ -134,95 +287,885 @@ int main(int argc, char *argv[])
     }
     Dataset = (char *) vret;
 
-    // Set the length to 400+ MB
-    ret  = ftruncate(Fdshm, DATASETSZ);
-    if (ret < 0) {
-        perror(NULL);
-        exit(-1);
-    }
+    /* Ask for transparent huge pages so the searchers take fewer TLB
+     * misses.  This only has an effect if /dev/shm allows huge pages
+     * (shmem_enabled or the huge= mount option). */
+    (void) madvise(Dataset, total + DATAPAD, MADV_HUGEPAGE);
 
-    /* clear the shared memory segment */
-    memset(Dataset, 0, DATASETSZ);
+    /* Blank out the old copies of the files that changed or went
+     * away.  A line of nulls has no substrings to hash. */
+    for (i = 0; i < Nstale; i++) {
+        memset(Dataset + Stale[i]->outoff, 0, Stale[i]->outlen);
+    }
 
-    /* scan the files loading their contents into shared memory */
-    do_files();
+    /* copy the files into shared memory and say where they went */
+    (void) do_files(1);
+    if (Update) {
+        printf("Loaded %ld new characters, %ld in all\n", total - Append, total);
+    }
+    else {
+        printf("Loaded %d characters\n", (int) total);
+    }
+    make_prov(total);
+    make_manifest(total);
+    make_lines(total);
+    if (Soa) {
+        make_soa(total);
+    }
 
     /* clean up and exit */
-    munmap(Dataset, DATASETSZ);
+    munmap(Dataset, total + DATAPAD);
     close(Fdshm);
     exit(0);
 }
 
 
 /*
- * do_files() : Load the files into the shared memory segment
+ * do_files() : run one pass over all of the files with Nthread
+ * threads.  Pass 0 maps each file and works out how many bytes it
+ * adds to the data set, less any repeated lines with -d, then gives
+ * each file its offset.  Pass 1
+ * copies the files to their offsets in the shared memory segment
+ * and unmaps them.  Files that an update (-u) keeps where they are
+ * are skipped, and the rest go after the old data.  Return the size
+ * of the data set.
+ */
+long do_files(int pass)
+{
+    pthread_t     thrds[MXTHRD]; // the loader threads
+    int           i;           // generic loop index
+    int           ret;         // return value from pthread_create()
+    long          total;       // running sum of file output lengths
+
+    Pass = pass;
+    Nextfile = 0;
+    for (i = 0; i < Nthread; i++) {
+        ret = pthread_create(&thrds[i], NULL, do_filethread, NULL);
+        if (ret != 0) {
+            fprintf(stderr,"Error - pthread_create() return code: %d\n", ret);
+            exit(-1);
+        }
+    }
+    for (i = 0; i < Nthread; i++) {
+        pthread_join(thrds[i], NULL);
+    }
+    if ((pass == 0) && Dedup) {
+        do_dedup();
+    }
+
+    /* prefix sum of the output lengths gives each file's offset */
+    total = Append;
+    for (i = 0; i < Nfiles; i++) {
+        if (Files[i].keep) {
+            continue;
+        }
+        Files[i].outoff = total;
+        total += Files[i].outlen;
+    }
+    return(total);
+}
+
+
+/*
+ * do_filethread() : take files until there are none left and do
+ * this pass on each.
  */
-void do_files()
+void *do_filethread(void *arg)
 {
     int           fidx;        // target file index in filelist
     char         *filename;    // Name of a file from the filelist
-    FILE         *fp;
-    char          line[MAXLINE]; // we do not really know the max line size
-    int           len;         // length of line
-    char         *pshm;        // points to next location of write in shared mem
-    char         *pret;        // return pointer from fgets
+    int           fd;          // the file
+    struct stat   st;          // its size
+    FILEINFO     *fi;          // what we know about it
+
+    while ((fidx = __atomic_fetch_add(&Nextfile, 1, __ATOMIC_RELAXED)) < Nfiles) {
+        fi = &Files[fidx];
+        if (fi->keep) {
+            continue;
+        }
+        if (Pass == 1) {
+            if (fi->size != 0) {
+                (void) do_lines(fi, Dataset + fi->outoff);
+                munmap(fi->map, fi->size);
+            }
+            continue;
+        }
+
+        filename = Namearray + (fidx * MAXNAMELEN);
+        fd = open(filename, O_RDONLY);
+        if ((fd < 0) || (fstat(fd, &st) < 0)) {
+            printf("Unable to open %s.  Exiting...\n", filename);
+            exit(-1);
+        }
+        fi->size = st.st_size;
+        fi->mtime = ((int64_t) st.st_mtim.tv_sec * 1000000000) + st.st_mtim.tv_nsec;
+        if (fi->size != 0) {
+            fi->map = mmap((void *) 0, fi->size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (fi->map == MAP_FAILED) {
+                printf("Unable to mmap %s.  Exiting...\n", filename);
+                exit(-1);
+            }
+            (void) madvise(fi->map, fi->size, MADV_SEQUENTIAL);
+            if (Dedup && (fi->size > UINT32_MAX)) {
+                printf("%s is too big to remove repeated lines from.  Exiting...\n", filename);
+                exit(-1);
+            }
+            fi->outlen = do_lines(fi, NULL);
+        }
+        close(fd);
+    }
+    return(NULL);
+}
+
+
+/*
+ * line_masks() : set bit i of *nl if p[i] is a newline and bit i of
+ * *cr if it is a carriage return, for the 64 bytes at p.
+ */
+static inline void line_masks(const char *p, uint64_t *nl, uint64_t *cr)
+{
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i cret = _mm_set1_epi8('\r');
+    __m128i       v;           // 16 bytes of p
     int           i;           // generic loop index
 
+    *nl = 0;
+    *cr = 0;
+    for (i = 0; i < 4; i++) {
+        v = _mm_loadu_si128((const __m128i *) (p + (16 * i)));
+        *nl |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v, lf)) << (16 * i);
+        *cr |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v, cret)) << (16 * i);
+    }
+}
 
-    /* Point to start of shared memory block */
-    pshm = Dataset;
 
-    /* copy each file int the file list to the shared memory segment */
-    for (fidx = 0; fidx < Nfiles; fidx += 1) {
-        filename = Namearray + (fidx * MAXNAMELEN);
+/*
+ * hash_line() : a 64 bit hash of the 'n' bytes at 'p'.  It only has
+ * to spread lines over a hash table; equal hashes are confirmed by
+ * comparing the lines.
+ */
+static inline uint64_t hash_line(const char *p, size_t n)
+{
+    uint64_t      h;           // the hash so far
+    uint64_t      w;           // the next 8 bytes of p
 
-        printf("Adding file %s\n", filename);
-        fp = fopen(filename, "r");
-        if (fp == NULL) {
-            printf("Unable to open %s.  Exiting...\n", filename);
+    h = n * 0x9e3779b97f4a7c15ULL;
+    for ( ; n >= 8; p += 8, n -= 8) {
+        memcpy(&w, p, 8);
+        h = (h ^ w) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 32;
+    }
+    w = 0;
+    memcpy(&w, p, n);
+    h = (h ^ w) * 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 29;
+    return(h);
+}
+
+
+/*
+ * do_lines() : walk the lines of a file.  Lines that are shorter than
+ * Sublen once CR is removed are dropped.  With 'out' NULL just return
+ * how many bytes the file adds to the data set, and with -d record
+ * each kept line in fi->lines.  Otherwise copy the kept lines to 'out'
+ * with CR removed and LF (or the end of the file) replaced by a null,
+ * skipping lines that fi->lines marks as repeats with -d.
+ */
+long do_lines(FILEINFO *fi, char *out)
+{
+    const char   *data;        // the file
+    size_t        size;        // and its length
+    char          tail[64];    // zero padded copy of a partial last block
+    const char   *blk;         // the 64 bytes we are looking at
+    size_t        base;        // offset of blk in the file
+    uint64_t      nl, cr;      // newline and CR bits of blk
+    size_t        start;       // offset of the start of the current line
+    size_t        end;         // offset of the newline ending it
+    long          ncr;         // CRs seen in the current line
+    long          len;         // length of the line without CRs
+    long          outlen;      // bytes written (or to write) to out
+    int           pos;         // bit number of a newline in nl
+    size_t        i;           // generic loop index
+    int           k;           // number of kept lines so far
+    LINEREC      *lr;          // the record of a kept line (-d)
+
+    data = fi->map;
+    size = fi->size;
+    outlen = 0;
+    start = 0;
+    ncr = 0;
+    k = 0;
+    for (base = 0; base <= size; base += 64) {
+        if (base + 64 <= size) {
+            blk = data + base;
+            line_masks(blk, &nl, &cr);
+        }
+        else {
+            /* the last partial block; the end of the file ends a line */
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, data + base, size - base);
+            line_masks(tail, &nl, &cr);
+            nl |= (uint64_t) 1 << (size - base);
+        }
+        while (nl != 0) {
+            pos = __builtin_ctzll(nl);
+            nl &= nl - 1;
+            end = base + pos;
+            ncr += __builtin_popcountll(cr & (((uint64_t) 1 << pos) - 1));
+            cr &= ~((((uint64_t) 1 << pos) << 1) - 1);
+            len = (long) (end - start) - ncr;
+            if (len >= Sublen) {
+                if (Dedup && (out == NULL)) {
+                    if (fi->nlines == fi->maxlines) {
+                        fi->maxlines = (fi->maxlines == 0) ? 1024 : (2 * fi->maxlines);
+                        fi->lines = realloc(fi->lines, fi->maxlines * sizeof(LINEREC));
+                        if (fi->lines == NULL) {
+                            printf("Unable to allocate the line table\n");
+                            exit(-1);
+                        }
+                    }
+                    lr = &fi->lines[fi->nlines++];
+                    lr->start = start;
+                    lr->rawlen = end - start - ((data[end - 1] == '\r') ? 1 : 0);
+                    lr->len = len;
+                    lr->first = -1;
+                    lr->hash = hash_line(data + start, lr->rawlen);
+                }
+                else if (Dedup && (fi->lines[k++].first >= 0)) {
+                    // a repeat of an earlier line
+                    start = end + 1;
+                    ncr = 0;
+                    continue;
+                }
+                if (out != NULL) {
+                    if (ncr == 0) {
+                        memcpy(out + outlen, data + start, len);
+                    }
+                    else if ((ncr == 1) && (data[end - 1] == '\r')) {
+                        memcpy(out + outlen, data + start, len);   // CRLF
+                    }
+                    else {
+                        for (i = start, len = 0; i < end; i++) {
+                            if (data[i] != '\r') {
+                                out[outlen + len++] = data[i];
+                            }
+                        }
+                    }
+                    // replace \n with null to make all lines strings
+                    out[outlen + len] = (char) 0;
+                }
+                outlen += len + 1;
+            }
+            start = end + 1;
+            ncr = 0;
+        }
+        ncr += __builtin_popcountll(cr);
+    }
+    return(outlen);
+}
+
+
+/*
+ * do_dedup() : find the repeated lines.  Number the kept lines of all
+ * files in filelist order, then have each thread take the lines whose
+ * hash falls in its share and mark every line after the first copy
+ * with the number of the first copy.  Each thread looks at its lines
+ * in filelist order, so the copy that is kept does not depend on the
+ * number of threads.  Last, work out what each file now adds to the
+ * data set.
+ */
+void do_dedup()
+{
+    pthread_t     thrds[MXTHRD]; // the dedup threads
+    long          t;           // thread index, also passed to the thread
+    int           ret;         // return value from pthread_create()
+    int           f, k;        // file and line indexes
+    FILEINFO     *fi;          // the file we are on
+    int           nkept;       // lines left after removing repeats
+
+    Nlines = 0;
+    for (f = 0; f < Nfiles; f++) {
+        if (Nlines > INT32_MAX - Files[f].nlines) {
+            printf("Too many lines to remove repeats from.  Exiting...\n");
             exit(-1);
         }
+        Files[f].line0 = Nlines;
+        Nlines += Files[f].nlines;
+    }
 
-        /* read and copy each line from the file */
-        while (1) {
-            pret = fgets(line, MAXLINE, fp);
-            if (pret == NULL) {
-                break;
+    for (t = 0; t < Nthread; t++) {
+        ret = pthread_create(&thrds[t], NULL, do_dedupthread, (void *) t);
+        if (ret != 0) {
+            fprintf(stderr,"Error - pthread_create() return code: %d\n", ret);
+            exit(-1);
+        }
+    }
+    for (t = 0; t < Nthread; t++) {
+        pthread_join(thrds[t], NULL);
+    }
+
+    nkept = 0;
+    for (f = 0; f < Nfiles; f++) {
+        fi = &Files[f];
+        fi->outlen = 0;
+        for (k = 0; k < fi->nlines; k++) {
+            if (fi->lines[k].first < 0) {
+                fi->outlen += fi->lines[k].len + 1;
+                nkept++;
             }
-            len = strlen(line);
-            if (len == (MAXLINE - 1)) {
-                printf("Warning: input line exceed length of %d.\n", MAXLINE - 1);
+        }
+    }
+    printf("Kept %d of %d lines\n", nkept, Nlines);
+}
+
+
+/*
+ * do_dedupthread() : mark the repeats among the lines whose hash
+ * belongs to thread number 'arg', using a hash table of the first
+ * copies.
+ */
+void *do_dedupthread(void *arg)
+{
+    long          me;          // our thread index
+    int           f, k;        // file and line indexes
+    LINEREC      *lr;          // the line we are on
+    LINESLOT     *tab;         // open addressed table of first copies
+    LINESLOT     *slot;        // an entry in tab
+    LINEREC      *lfirst;      // the line in that entry
+    uint64_t      tmask;       // size of tab less one
+    uint64_t      h;           // index into tab
+    long          nmine;       // number of lines in our share
+
+    me = (long) arg;
+    nmine = 0;
+    for (f = 0; f < Nfiles; f++) {
+        for (k = 0; k < Files[f].nlines; k++) {
+            if (((Files[f].lines[k].hash >> 32) % Nthread) == me) {
+                nmine++;
             }
-            if (len < Sublen) {
-                //printf("Discarding short line\n");
+        }
+    }
+    for (tmask = 1023; tmask < 2 * nmine; tmask = (tmask << 1) | 1)
+        ;
+    tab = malloc((tmask + 1) * sizeof(LINESLOT));
+    if (tab == NULL) {
+        printf("Unable to allocate a line hash table\n");
+        exit(-1);
+    }
+    for (h = 0; h <= tmask; h++) {
+        tab[h].k = -1;
+    }
+
+    for (f = 0; f < Nfiles; f++) {
+        for (k = 0; k < Files[f].nlines; k++) {
+            lr = &Files[f].lines[k];
+            if (((lr->hash >> 32) % Nthread) != me) {
                 continue;
             }
-            for (i = 0; i < len; i++) {
-                if (line[i] == '\r') {
+            for (h = lr->hash & tmask; ; h = (h + 1) & tmask) {
+                slot = &tab[h];
+                if (slot->k < 0) {
+                    // the first copy
+                    slot->hash = lr->hash;
+                    slot->file = f;
+                    slot->k = k;
+                    break;
+                }
+                if (slot->hash != lr->hash) {
                     continue;
                 }
-                // replace \n with null to make all lines strings
-                if (line[i] == '\n') {
-                    *pshm = (char) 0;
+                lfirst = &Files[slot->file].lines[slot->k];
+                if ((lfirst->rawlen == lr->rawlen) &&
+                    (memcmp(Files[slot->file].map + lfirst->start,
+                            Files[f].map + lr->start, lr->rawlen) == 0)) {
+                    lr->first = Files[slot->file].line0 + slot->k;
+                    break;
                 }
-                else {
-                    *pshm = line[i];
+            }
+        }
+    }
+    free(tab);
+    return(NULL);
+}
+
+
+/*
+ * cmp_run() : qsort() ordering of provenance runs by offset
+ */
+static int cmp_run(const void *pa, const void *pb)
+{
+    const struct provrun *a = pa;
+    const struct provrun *b = pb;
+
+    if (a->offset != b->offset)
+        return((a->offset < b->offset) ? -1 : 1);
+    return(0);
+}
+
+
+/*
+ * make_prov() : write "/gutenberg.prov" to say which files each part
+ * of the 'total' byte data set came from.  Without -d each file is
+ * one run.  With -d consecutive lines from one file that are found
+ * nowhere else share a run, and a line found in several files gets a
+ * run that lists them all, in filelist order.
+ */
+void make_prov(long total)
+{
+    struct provrun *runs;      // the run table
+    long          nruns;       // entries in runs
+    long          maxruns;     // entries allocated for runs
+    uint32_t     *refs;        // the file reference table
+    long          nrefs;       // entries in refs
+    long          maxrefs;     // entries allocated for refs
+    uint32_t     *nref;        // number of files each line is in (-d)
+    uint32_t     *refat;       // where each line's files are in lref (-d)
+    int32_t      *last;        // last file counted for each line (-d)
+    uint32_t     *lref;        // every line's files (-d)
+    uint32_t      nl;          // entries in lref
+    int           f, k;        // file and line indexes
+    int           g;           // line number over all files
+    int           u;           // line number of the first copy of line g
+    long          off;         // offset of a line in the data set
+    struct provrun *prev;      // the run before the one we are adding
+    struct provhdr *hdr;       // start of the segment
+    long          seglen;      // length of the segment
+    int           fd;          // the segment
+    char         *seg;         // and where it is mapped
+
+    maxruns = Nfiles + 1;
+    maxrefs = Nfiles + 1;
+    runs = malloc(maxruns * sizeof(struct provrun));
+    refs = malloc(maxrefs * sizeof(uint32_t));
+    if ((runs == NULL) || (refs == NULL)) {
+        printf("Unable to allocate the provenance tables\n");
+        exit(-1);
+    }
+    nruns = 0;
+    nrefs = 0;
+
+    if (Dedup == 0) {
+        for (f = 0; f < Nfiles; f++) {
+            if (Files[f].outlen != 0) {
+                runs[nruns].offset = Files[f].outoff;
+                runs[nruns].ref = nrefs;
+                runs[nruns].nref = 1;
+                nruns++;
+                refs[nrefs++] = f;
+            }
+        }
+        // after an update the files are not in filelist order
+        qsort(runs, nruns, sizeof(struct provrun), cmp_run);
+    }
+    else {
+        /* List the files each first copy is found in: count, then fill */
+        nref = calloc(Nlines + 1, sizeof(uint32_t));
+        refat = malloc((Nlines + 1) * sizeof(uint32_t));
+        last = malloc((Nlines + 1) * sizeof(int32_t));
+        if ((nref == NULL) || (refat == NULL) || (last == NULL)) {
+            printf("Unable to allocate the provenance tables\n");
+            exit(-1);
+        }
+        memset(last, 0xff, (Nlines + 1) * sizeof(int32_t));
+        for (f = 0; f < Nfiles; f++) {
+            for (k = 0; k < Files[f].nlines; k++) {
+                g = Files[f].line0 + k;
+                u = (Files[f].lines[k].first < 0) ? g : Files[f].lines[k].first;
+                if (last[u] != f) {
+                    last[u] = f;
+                    nref[u]++;
+                }
+            }
+        }
+        nl = 0;
+        for (g = 0; g < Nlines; g++) {
+            refat[g] = nl;
+            nl += nref[g];
+            nref[g] = 0;
+        }
+        lref = malloc((nl + 1) * sizeof(uint32_t));
+        if (lref == NULL) {
+            printf("Unable to allocate the provenance tables\n");
+            exit(-1);
+        }
+        memset(last, 0xff, (Nlines + 1) * sizeof(int32_t));
+        for (f = 0; f < Nfiles; f++) {
+            for (k = 0; k < Files[f].nlines; k++) {
+                g = Files[f].line0 + k;
+                u = (Files[f].lines[k].first < 0) ? g : Files[f].lines[k].first;
+                if (last[u] != f) {
+                    last[u] = f;
+                    lref[refat[u] + nref[u]++] = f;
+                }
+            }
+        }
+
+        /* Walk the kept lines in data set order making the runs */
+        for (f = 0; f < Nfiles; f++) {
+            off = Files[f].outoff;
+            for (k = 0; k < Files[f].nlines; k++) {
+                if (Files[f].lines[k].first >= 0) {
+                    continue;
+                }
+                g = Files[f].line0 + k;
+                prev = (nruns > 0) ? &runs[nruns - 1] : NULL;
+                if ((nref[g] == 1) && (prev != NULL) && (prev->nref == 1) &&
+                    (refs[prev->ref] == (uint32_t) f)) {
+                    // more of the same file
+                    off += Files[f].lines[k].len + 1;
+                    continue;
                 }
-                pshm++;
-                if ((int) (pshm - Dataset) == DATASETSZ) {
-                    printf("Out of space in shared memory segment. Exiting...\n");
+                if (nruns == maxruns) {
+                    maxruns *= 2;
+                    runs = realloc(runs, maxruns * sizeof(struct provrun));
+                }
+                if (nrefs + nref[g] > maxrefs) {
+                    maxrefs = 2 * (nrefs + nref[g]);
+                    refs = realloc(refs, maxrefs * sizeof(uint32_t));
+                }
+                if ((runs == NULL) || (refs == NULL)) {
+                    printf("Unable to allocate the provenance tables\n");
                     exit(-1);
                 }
+                runs[nruns].offset = off;
+                runs[nruns].ref = nrefs;
+                runs[nruns].nref = nref[g];
+                nruns++;
+                memcpy(&refs[nrefs], &lref[refat[g]], nref[g] * sizeof(uint32_t));
+                nrefs += nref[g];
+                off += Files[f].lines[k].len + 1;
             }
+            free(Files[f].lines);
         }
+        free(nref);
+        free(refat);
+        free(last);
+        free(lref);
     }
-    printf("Loaded %d characters\n", (int) (pshm - Dataset));
 
-    // truncate the length to the actual length of the dataset
-    if( 0 > ftruncate(Fdshm, (int) (pshm - Dataset + 100))) {
+    /* Replace any old "/gutenberg.prov" with the tables */
+    seglen = sizeof(struct provhdr) + ((long) Nfiles * MAXNAMELEN) +
+             (nruns * sizeof(struct provrun)) + (nrefs * sizeof(uint32_t));
+    (void) shm_unlink(PROVSHM);
+    fd = shm_open(PROVSHM, O_RDWR | O_CREAT, 0666);
+    if ((fd < 0) || (ftruncate(fd, seglen) < 0)) {
+        printf("Unable to create %s\n", PROVSHM);
         perror(NULL);
         exit(-1);
     }
+    seg = mmap((void *) 0, seglen, (PROT_READ | PROT_WRITE), MAP_SHARED, fd, 0);
+    if (seg == MAP_FAILED) {
+        printf("Unable to mmap %s\n", PROVSHM);
+        perror(NULL);
+        exit(1);
+    }
+    hdr = (struct provhdr *) seg;
+    hdr->magic = PROVMAGIC;
+    hdr->nfiles = Nfiles;
+    hdr->datalen = total;
+    hdr->nruns = nruns;
+    hdr->nrefs = nrefs;
+    seg += sizeof(struct provhdr);
+    memcpy(seg, Namearray, (size_t) Nfiles * MAXNAMELEN);
+    seg += (size_t) Nfiles * MAXNAMELEN;
+    memcpy(seg, runs, nruns * sizeof(struct provrun));
+    seg += nruns * sizeof(struct provrun);
+    memcpy(seg, refs, nrefs * sizeof(uint32_t));
+    munmap(hdr, seglen);
+    close(fd);
+    free(runs);
+    free(refs);
+}
+
+
+/*
+ * cmp_ent() : qsort() and bsearch() ordering of pointers to manifest
+ * entries by file name
+ */
+static int cmp_ent(const void *pa, const void *pb)
+{
+    const struct manifestent *a = *(struct manifestent * const *) pa;
+    const struct manifestent *b = *(struct manifestent * const *) pb;
+
+    return(strncmp(a->name, b->name, MAXNAMELEN));
 }
 
 
+/*
+ * plan_update() : match the files in the filelist against the manifest
+ * of the last load (-u).  A file with the same name, size and
+ * modification time as before stays where it is in the data set.  The
+ * rest will be loaded after the old data, and the old places of files
+ * that changed or left the filelist go in Stale to be zeroed.  Return
+ * 0, after saying why, if the data set has to be loaded from scratch
+ * instead.
+ */
+int plan_update()
+{
+    int           fd;          // the manifest or the data set
+    struct stat   st;          // its size
+    struct manifesthdr *hdr;   // the manifest
+    struct manifestent *ent;   // its entries
+    struct manifestent **byname; // the entries sorted by name
+    struct manifestent key;    // a file to look up
+    struct manifestent *kp;    // pointer to it for bsearch()
+    struct manifestent **hit;  // its entry
+    char         *used;        // entries that are still in place
+    long          dead;        // bytes of the data set that will be dead
+    int           nkeep;       // files left in place
+    int           f, e;        // file and entry indexes
+
+    fd = shm_open(MANIFESTSHM, O_RDONLY, 0);
+    if ((fd < 0) || (fstat(fd, &st) < 0) || (st.st_size < (long) sizeof(struct manifesthdr))) {
+        printf("No manifest of the last load, loading everything\n");
+        return(0);
+    }
+    hdr = mmap((void *) 0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if ((hdr == MAP_FAILED) || (hdr->magic != MANIFESTMAGIC) ||
+        (st.st_size != (long) (sizeof(struct manifesthdr) +
+                               ((long) hdr->nfiles * sizeof(struct manifestent))))) {
+        printf("The manifest of the last load is damaged, loading everything\n");
+        return(0);
+    }
+    if (hdr->sublen != (uint32_t) Sublen) {
+        printf("The last load was for length %d, loading everything\n", (int) hdr->sublen);
+        return(0);
+    }
+    if (hdr->dedup || Dedup) {
+        printf("Repeated lines can only be removed (-d) by loading everything\n");
+        return(0);
+    }
+    fd = shm_open("/gutenberg", O_RDONLY, 0);
+    if ((fd < 0) || (fstat(fd, &st) < 0) ||
+        ((uint64_t) st.st_size != hdr->datalen + DATAPAD)) {
+        printf("/gutenberg does not match the manifest, loading everything\n");
+        return(0);
+    }
+    close(fd);
+
+    /* Look each file up by name */
+    ent = (struct manifestent *) (hdr + 1);
+    byname = malloc((hdr->nfiles + 1) * sizeof(struct manifestent *));
+    used = calloc(hdr->nfiles + 1, 1);
+    Stale = malloc((hdr->nfiles + 1) * sizeof(struct manifestent *));
+    if ((byname == NULL) || (used == NULL) || (Stale == NULL)) {
+        printf("Unable to allocate the manifest tables\n");
+        exit(-1);
+    }
+    for (e = 0; e < (int) hdr->nfiles; e++) {
+        byname[e] = &ent[e];
+    }
+    qsort(byname, hdr->nfiles, sizeof(struct manifestent *), cmp_ent);
+    nkeep = 0;
+    kp = &key;
+    for (f = 0; f < Nfiles; f++) {
+        memcpy(key.name, Namearray + ((long) f * MAXNAMELEN), MAXNAMELEN);
+        hit = bsearch(&kp, byname, hdr->nfiles, sizeof(struct manifestent *), cmp_ent);
+        if ((hit == NULL) || used[*hit - ent] || (stat(key.name, &st) < 0) ||
+            ((uint64_t) st.st_size != (*hit)->size) ||
+            ((((int64_t) st.st_mtim.tv_sec * 1000000000) + st.st_mtim.tv_nsec) != (*hit)->mtime)) {
+            continue;
+        }
+        used[*hit - ent] = 1;
+        Files[f].keep = 1;
+        Files[f].size = (*hit)->size;
+        Files[f].mtime = (*hit)->mtime;
+        Files[f].outoff = (*hit)->outoff;
+        Files[f].outlen = (*hit)->outlen;
+        nkeep++;
+    }
+
+    /* What is not kept is dead */
+    dead = hdr->dead;
+    Nstale = 0;
+    for (e = 0; e < (int) hdr->nfiles; e++) {
+        if ((used[e] == 0) && (ent[e].outlen != 0)) {
+            Stale[Nstale++] = &ent[e];
+            dead += ent[e].outlen;
+        }
+    }
+    free(byname);
+    free(used);
+    if (dead * MAXDEAD > (long) hdr->datalen) {
+        printf("%ld of the %ld bytes loaded are out of date, loading everything\n",
+               dead, (long) hdr->datalen);
+        for (f = 0; f < Nfiles; f++) {
+            memset(&Files[f], 0, sizeof(FILEINFO));
+        }
+        Nstale = 0;
+        return(0);
+    }
+    Append = hdr->datalen;
+    Dead = dead;
+    printf("Updating: %d files unchanged, %d new or changed, %d old copies to blank out\n",
+           nkeep, Nfiles - nkeep, Nstale);
+    return(1);
+}
+
+
+/*
+ * make_manifest() : write "/gutenberg.manifest" to record where each
+ * file is in the 'total' byte data set and the size and modification
+ * time it had when it was loaded.
+ */
+void make_manifest(long total)
+{
+    struct manifesthdr *hdr;   // start of the segment
+    struct manifestent *ent;   // its entries
+    long          seglen;      // length of the segment
+    int           fd;          // the segment
+    int           f;           // file index
+
+    seglen = sizeof(struct manifesthdr) + ((long) Nfiles * sizeof(struct manifestent));
+    fd = shm_open(MANIFESTSHM, O_RDWR | O_CREAT, 0666);
+    if ((fd < 0) || (ftruncate(fd, seglen) < 0)) {
+        printf("Unable to create %s\n", MANIFESTSHM);
+        perror(NULL);
+        exit(-1);
+    }
+    hdr = mmap((void *) 0, seglen, (PROT_READ | PROT_WRITE), MAP_SHARED, fd, 0);
+    if (hdr == MAP_FAILED) {
+        printf("Unable to mmap %s\n", MANIFESTSHM);
+        perror(NULL);
+        exit(1);
+    }
+    ent = (struct manifestent *) (hdr + 1);
+    for (f = 0; f < Nfiles; f++) {
+        memcpy(ent[f].name, Namearray + ((long) f * MAXNAMELEN), MAXNAMELEN);
+        ent[f].size = Files[f].size;
+        ent[f].mtime = Files[f].mtime;
+        ent[f].outoff = Files[f].outoff;
+        ent[f].outlen = Files[f].outlen;
+    }
+    hdr->nfiles = Nfiles;
+    hdr->sublen = Sublen;
+    hdr->dedup = Dedup;
+    hdr->datalen = total;
+    hdr->dead = Dead;
+    hdr->magic = MANIFESTMAGIC;
+    munmap(hdr, seglen);
+    close(fd);
+}
+
+
+/*
+ * make_lines() : write "/gutenberg.lines" to list the start and length
+ * of every line in the 'total' byte data set.  The empty lines, which
+ * include the bytes that updates zeroed, are left out.
+ */
+void make_lines(long total)
+{
+    struct lineshdr *hdr;      // start of the segment
+    struct lineent *ent;       // its entries
+    long          nlines;      // number of entries
+    long          seglen;      // length of the segment
+    const char   *p;           // start of a line
+    const char   *nul;         // its end
+    int           fd;          // the segment
+    int           pass;        // 0 to count the lines, 1 to record them
+
+    hdr = NULL;
+    ent = NULL;
+    seglen = 0;
+    fd = -1;
+    for (pass = 0; pass < 2; pass++) {
+        nlines = 0;
+        for (p = Dataset; p < Dataset + total; p = nul + 1) {
+            nul = memchr(p, 0, Dataset + total - p);
+            if (nul == NULL) {
+                nul = Dataset + total;
+            }
+            if (nul > p) {
+                if (pass == 1) {
+                    ent[nlines].offset = p - Dataset;
+                    ent[nlines].len = nul - p;
+                }
+                nlines++;
+            }
+        }
+        if (pass == 1) {
+            break;
+        }
+        seglen = sizeof(struct lineshdr) + (nlines * sizeof(struct lineent));
+        fd = shm_open(LINESHM, O_RDWR | O_CREAT, 0666);
+        if ((fd < 0) || (ftruncate(fd, seglen) < 0)) {
+            printf("Unable to create %s\n", LINESHM);
+            perror(NULL);
+            exit(-1);
+        }
+        hdr = mmap((void *) 0, seglen, (PROT_READ | PROT_WRITE), MAP_SHARED, fd, 0);
+        if (hdr == MAP_FAILED) {
+            printf("Unable to mmap %s\n", LINESHM);
+            perror(NULL);
+            exit(1);
+        }
+        ent = (struct lineent *) (hdr + 1);
+    }
+    hdr->minlen = Sublen;
+    hdr->datalen = total;
+    hdr->nlines = nlines;
+    hdr->magic = LINESMAGIC;
+    munmap(hdr, seglen);
+    close(fd);
+}
+
+
+/*
+ * make_soa() : write "/gutenberg.soa", the 'total' byte data set cut
+ * into SOASTREAMS streams with their words interleaved.
+ */
+void make_soa(long total)
+{
+    struct soahdr *hdr;        // start of the segment
+    uint32_t     *rows;        // its rows
+    long          step;        // bytes between stream starts
+    long          nrows;       // rows in the segment
+    long          seglen;      // length of the segment
+    long          r;           // row index
+    long          at;          // where a word comes from in the data set
+    int           fd;          // the segment
+    int           st;          // stream index
+
+    /* The stream starts are 64 byte aligned, and each stream reads
+     * on SOAPAD bytes past its end */
+    step = ((total + SOASTREAMS - 1) / SOASTREAMS + 63) & ~63L;
+    nrows = (step + SOAPAD) / 4;
+    seglen = sizeof(struct soahdr) + (nrows * SOASTREAMS * sizeof(uint32_t));
+    fd = shm_open(SOASHM, O_RDWR | O_CREAT, 0666);
+    if ((fd < 0) || (ftruncate(fd, seglen) < 0)) {
+        printf("Unable to create %s\n", SOASHM);
+        perror(NULL);
+        exit(-1);
+    }
+    hdr = mmap((void *) 0, seglen, (PROT_READ | PROT_WRITE), MAP_SHARED, fd, 0);
+    if (hdr == MAP_FAILED) {
+        printf("Unable to mmap %s\n", SOASHM);
+        perror(NULL);
+        exit(1);
+    }
+    (void) madvise(hdr, seglen, MADV_HUGEPAGE);
+
+    /* New space reads as zeros, so the words past the end of the data
+     * set are left alone */
+    rows = (uint32_t *) (hdr + 1);
+    for (st = 0; st < SOASTREAMS; st++) {
+        for (r = 0; r < nrows; r++) {
+            at = (st * step) + (r * 4);
+            if (at + 4 <= total) {
+                memcpy(&rows[(r * SOASTREAMS) + st], Dataset + at, 4);
+            }
+            else if (at < total) {
+                memcpy(&rows[(r * SOASTREAMS) + st], Dataset + at, total - at);
+            }
+        }
+    }
+    hdr->nstreams = SOASTREAMS;
+    hdr->datalen = total;
+    hdr->step = step;
+    hdr->nrows = nrows;
+    hdr->magic = SOAMAGIC;
+    munmap(hdr, seglen);
+    close(fd);
+    printf("Wrote %d interleaved streams of %ld characters\n", SOASTREAMS, step);
+}
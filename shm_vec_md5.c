@@ -7,32 +7,100 @@
  *
  * MD5 sums are calculated using C code copied from the Linux
  * md5sum command source which is in the coreutils package.
- * Sums are calculated 8 at a time using the AVX vector
- * extensions.
+ * Sums are calculated 16, 8 or 4 at a time using the AVX-512,
+ * AVX2 or SSE2 vector extensions, whichever is the widest the
+ * cpu supports.  The kernels are in vmd5_kernel.h.  With -H the
+ * targets are SHA-1 or SHA-256 sums instead, and the kernels for
+ * those, in vsha_kernel.h, are plugged into the same search.
  *
  * The program spawns 1 to 64 threads to look for the
- * matching MD5 sum.
+ * matching MD5 sum.  A whole batch of target sums can be
+ * given in a file, in which case every substring is checked
+ * against all of the targets in the same pass over the data.
  *
  */
 
 /*
  *
  * Usage:  This program is intended to be run on a
- * multicore machine.  The load is divided by having
- * each thread/instance of this program process a
- * subset of /gutenberg.  Command line parameter 1
- * gives how many threads we want to spawn.
+ * multicore machine.  The load is divided by cutting
+ * /gutenberg into small chunks that the threads take
+ * from a shared counter until none are left, so a
+ * thread that gets easy chunks just does more of them.
+ * Command line parameter 1 gives how many threads we
+ * want to spawn.
  *    time shm_vec_md5 8 xxxxxxxxxxxxxxxxxxxxxxxxxxxxx
+ * The substring length defaults to 22 and is set with -l:
+ *    time shm_vec_md5 -l 19 8 xxxxxxxxxxxxxxxxxxxxxxxxxxxxx
+ * A shm_init run without a length serves every length.  The
+ * threads find the lines through its index, /gutenberg.lines,
+ * and skip those that are too short.  If it was also run with -s,
+ * -S has MD5 searches for lengths up to 55 read the interleaved copy,
+ * /gutenberg.soa, with one aligned load for a word of every stream.
+ * That only pays on text with long lines, so time it with -T -S.
+ * When the length is not known, give a range and every length in it
+ * is searched in one pass.  Each chunk is hashed for all of them in
+ * turn while it is still in the cache:
+ *    time shm_vec_md5 -l 19-55 -f digests.txt 8
+ * To search for many sums at once put them in a file, one
+ * hex sum per line, and give the file with -f:
+ *    time shm_vec_md5 -f digests.txt 8
+ * The search stops once every target is found.  Use -a to
+ * keep going and report every matching offset.
+ * To report every substring whose sum starts with given bits
+ * give them in hex with -m, with /bits to compare fewer bits
+ * than the digits give, or as value:mask to compare any bits:
+ *    time shm_vec_md5 -l 19 -m 00000/18 8
+ * On multi-socket machines use -p to pin each thread to a
+ * core, spread over the NUMA nodes, and -r to also give each
+ * node its own copy of the data set in node-local memory.
+ * Use -s 5 to have a progress report on stderr every 5
+ * seconds; a summary of the hash rate is always printed there
+ * at the end.  The per-thread counters behind these are also in
+ * the shared memory segment /gutenberg.stats.<pid> (see
+ * gutenberg.h) for monitors to read.
+ * To answer many queries without starting a new process and
+ * faulting /gutenberg in for each one, run a daemon that keeps
+ * its threads waiting between queries on a Unix domain socket:
+ *    shm_vec_md5 -d /tmp/md5.sock 8
+ * and send it queries, one sum per line and a blank line to end
+ * each query (see read_query()).
+ * To search files that have not been loaded with shm_init, or a
+ * corpus too big for memory, give the file list with -F.  The files
+ * are read in windows of whole lines, with the threads hashing one
+ * window while the next is read:
+ *    time shm_vec_md5 -F filelist -f digests.txt 8
+ * To spread a search over several machines, each with its own
+ * /gutenberg, start a coordinator that waits for 3 workers and then
+ * start the workers, each with its own number of threads:
+ *    shm_vec_md5 -C 5050 -f digests.txt 3
+ *    shm_vec_md5 -W coordhost:5050 8
+ * When the same length is searched again and again, hash it once
+ * into a digest index file and look sums up in that instead:
+ *    shm_vec_md5 -l 22 -w /var/tmp/gutenberg.22.idx 8
+ *    shm_vec_md5 -l 22 -i /var/tmp/gutenberg.22.idx -f digests.txt 8
+ * SHA-1 and SHA-256 sums are searched for the same way with -H:
+ *    time shm_vec_md5 -H sha256 -f sha256-digests.txt 8
+ * To check the kernels against a plain MD5 and time them on
+ * a synthetic corpus (64MB, lines of 10 to 75 characters) with
+ * 1, 2, 4 and 8 threads:
+ *    shm_vec_md5 -b 64,10,75 8
+ * To pick the kernel, thread count and chunk size for this host,
+ * and use them whenever the thread count is given as 0:
+ *    shm_vec_md5 -T 16
+ *    time shm_vec_md5 -f digests.txt 0
  */
 
 /*
- * Build as: gcc -o shm_vec_md5 shm_vec_md5.c -lpthread -lrt -march=broadwell -mavx2 -O3
+ * Build as: gcc -o shm_vec_md5 shm_vec_md5.c -lpthread -lrt -O3
  */
 
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdarg.h>
 #include <ctype.h>
 #include <pthread.h>
 #include <sys/types.h>
@@ -40,37 +108,191 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sched.h>
+#include <dirent.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <poll.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <immintrin.h>
+#include "gutenberg.h"
 
 
 
 /****************************** DEFINES ****************************/
 const char *filelist = "filelist";
 const char *hexdigits = "0123456789abcdef";
-#define MAXNAMELEN 512
 #define MXTHRD      64      /* Limit the number of threads */
-#define MD5_DIGEST_LENGTH 16
-        // The length of the target substring
-#define Sublen     (22)
+#define MAXWORDS    8       /* most 32 bit words in a sum (SHA-256) */
+#define MAXDIGLINE  256     /* longest line accepted in a digest file */
+#define MINTBITS    10      /* smallest target prefilter bitmap (bits of A) */
+#define MAXTBITS    24      /* largest target prefilter bitmap, 2MB */
+#define MINSUBLEN   19      /* shortest substring length we have a kernel for */
+#define MAXONEBLK   55      /* longest substring that fits in one MD5 block */
+#define MAXSUBLEN   119     /* longest substring that fits in two MD5 blocks */
+#define MAXSETS     4       /* most sets of vector lanes hashed together */
+#define MAXLANES    32      /* most substrings hashed by one kernel call, one per mask bit */
+#define SETS_AVX512 2       /* sets of lanes the one block kernels hash together, */
+#define SETS_AVX2   3       /* for each instruction set.  More sets hide more of */
+#define SETS_SSE2   3       /* the latency of each set's steps, until the state */
+#define SETS_SCALAR 4       /* no longer fits in the registers */
+#define SOAPOS(vl, sets)    /* positions per call for the interleaved copy */ \
+        ((((sets) * (vl)) / SOASTREAMS) > 0 ? (((sets) * (vl)) / SOASTREAMS) : 1)
+#define DEFSUBLEN   22      /* substring length if -l is not given */
+#define CHUNKSZ     (256 * 1024) /* substrings in one unit of work, unless tuned */
+#define MINCHUNK    (16 * 1024)  /* smallest and largest chunk size a profile */
+#define MAXCHUNK    (16 * 1024 * 1024) /* may give */
+#define PROFILEFMT  "%s/.shm_vec_md5.%s" /* tuned settings, in $HOME, per host */
+#define TUNEMB      32      /* megabytes of /gutenberg the tuning trials search */
+#define TUNESECS    0.25    /* shortest tuning trial, searching the slice repeatedly */
+#define MAXNODES    64      /* most NUMA nodes we will use */
+#define MAXCPUS     1024    /* most cpus we look for in a node's cpulist */
+#define CPUSYS      "/sys/devices/system/cpu" /* where each cpu's topology is */
+#define HUGEPAGESZ  (2 * 1024 * 1024)
+#define PROVSHOW    8       /* most source files listed for one match */
+#define QUERY_EOF   0       /* read_query(): the client has gone */
+#define QUERY_OK    1       /* read_query(): a query to run */
+#define QUERY_BAD   2       /* read_query(): a query with errors, already reported */
+#define QUERY_QUIT  3       /* read_query(): shut the daemon down */
+#define IDXMAGIC    0x78646d35  /* "5mdx", start of a digest index file */
+#define IDXBUCKET   8       /* entries per index bucket we aim for */
+#define FPSTEP      (1024 * 1024) /* data_fingerprint() samples 64 bytes this often */
+#define MAXPEERS    1024    /* most workers a coordinator takes (-C) */
+#define MAXMSG      512     /* longest line between coordinator and worker */
+#define RANGESPLIT  8       /* ranges handed to each worker, roughly (-C) */
+#define WINDOWSZ    (32 * 1024 * 1024) /* bytes of lines in one window of a stream (-F) */
+#define READSZ      (4 * 1024 * 1024)  /* bytes read from a file at a time (-F) */
+#define HITBUFSZ    (64 * 1024) /* bytes of prefix search hits a thread holds (-m) */
+#define HITLINE     ((8 * MAXWORDS) + MAXSUBLEN + 64) /* longest hit line */
+#ifndef MPOL_BIND
+#define MPOL_BIND   2       /* from <numaif.h>, saves needing libnuma */
+#endif
+
+    /* A thread's prefix search hits (-m), formatted but not yet
+     * written, so that the threads only take Outlock to write out a
+     * full buffer */
+typedef struct {
+    int         len;        // bytes in buf
+    long        nhit;       // hits in buf
+    char        buf[HITBUFSZ];
+} HITBUF;
 
 typedef struct {
     pthread_t   thread_id;  // returned from creat()
     int         thread_idx; // index in range 0 to Nthread
+    int         cpu;        // cpu we are pinned to, or -1
+    int         node;       // index into Nodes of that cpu's node
+    char       *data;       // the copy of the data set we scan
+    struct statslot *stats; // our counters
+    HITBUF     *hits;       // our prefix search hits (-m), or NULL
 } THRDINFO;
 
-    /* vector definition for 8 unsigned ints */
-typedef uint32_t v8vecui __attribute__ ((vector_size (32)));
+    /* A NUMA node and the cpus in it that we are allowed to run on */
+typedef struct {
+    int         id;         // node number in /sys/devices/system/node
+    int         ncpu;       // number of usable cpus on the node
+    int        *cpus;       // the usable cpus
+    int         ncore;      // number of cores they make up
+    int        *cores;      // the first usable cpu of each core
+    char       *data;       // node-local copy of the data set (-r)
+    size_t      datasz;     // size of the mapping at data if it is a copy
+} NUMANODE;
+
+    /* A window of the data set when it is read straight from the
+     * files (-F).  It holds whole lines, stored as shm_init would
+     * store them, and says which files they came from. */
+typedef struct {
+    char       *data;       // the lines, followed by DATAPAD zero bytes
+    long        size;       // bytes of lines data can hold
+    long        len;        // bytes of lines in it
+    long        base;       // offset of data[0] in the whole data set
+    struct provrun *runs;   // where each file's lines start in data
+    long        nruns;      // entries in runs
+    long        maxruns;    // entries allocated for runs
+} WINDOW;
+
+    /* Where the reader of a stream (-F) is in the file list */
+typedef struct {
+    char       *names;      // the file list, MAXNAMELEN bytes per name
+    int         nfiles;     // number of names
+    int         file;       // file being read
+    int         fd;         // it, or -1 before it is opened
+    off_t       pos;        // how far into it we have read
+    char       *raw;        // bytes read but not yet stored in a window
+    long        rawsz;      // allocated size of raw
+    long        rawlen;     // bytes in raw
+    long        rawpos;     // start of the first line not yet stored
+    int         eof;        // all of the file is in raw
+    long        outoff;     // bytes of lines stored so far
+} STREAM;
+
+    /* Lines coming in on a socket, read as they arrive */
+typedef struct {
+    int         fd;         // the socket
+    int         len;        // bytes in buf
+    char        buf[MAXMSG];
+} LINEBUF;
+
+    /* A worker process as the coordinator (-C) sees it */
+typedef struct {
+    LINEBUF     lb;         // what it has sent us
+    int         active;     // still connected
+    int         first;      // first chunk of the range it is searching
+    int         last;       // and the chunk after it, equal if none
+    uint64_t    hashed;     // substrings it says it has hashed
+} PEER;
+
+    /* A sum as the kernels compute it: Hash->nwords words, in the
+     * order the hash defines them.  For the big endian hashes the
+     * bytes of each word are the other way round from the printed
+     * sum.  The words past nwords are zero. */
+union targetsum {
+    uint32_t    i[MAXWORDS]; // target sum as ints
+    uint8_t     c[4 * MAXWORDS]; // target sum as chars
+};
+
+    /* The set of sums we are looking for.  A bitmap indexed by the
+     * low 'bits' bits of the A word rejects nearly every candidate
+     * with a single load; survivors are confirmed by a binary search
+     * of the sorted table of full sums.  A prefix search (-m) has one
+     * target, the bits to match, and a mask of which bits those are. */
+struct targetset {
+    int              count;     // number of distinct target sums
+    int              found;     // number of targets located so far
+    union targetsum *sums;      // target sums sorted by i[0], i[1]...
+    char            *done;      // set to 1 once sums[n] has been reported
+    uint64_t        *bitmap;    // prefilter bitmap, 2^bits bits
+    uint32_t         bmask;     // (2^bits) - 1
+    union targetsum *mask;      // bits of each word to compare (-m), or NULL
+};
 
-union v8ui {
-    v8vecui  v;    // vector
-    uint32_t s[8]; // scalar equivalent
+    /* A digest index file (-w, -i) holds the sum of every substring
+     * of one length.  The idxhdr is followed by the bucket table,
+     * 2^bbits + 1 entry numbers, and then the entries grouped by
+     * bucket.  The bucket of a sum is the top bbits bits of its A
+     * word, and the entries of bucket b are ent[tab[b]] up to
+     * ent[tab[b + 1]]. */
+struct idxhdr {
+    uint32_t    magic;      // IDXMAGIC
+    uint32_t    sublen;     // substring length indexed
+    uint64_t    datalen;    // length of the data set indexed
+    uint64_t    datasum;    // its data_fingerprint()
+    uint64_t    count;      // number of entries
+    uint32_t    bbits;      // log2 of the number of buckets
+    uint32_t    hash;       // index in Hashes of the hash indexed
 };
 
-union targetmd5 {
-    // note that 4 is MD5_DIGEST_LENGTH/sizeof(uint32_t)
-    uint32_t    i[4];       // target MD5 sum  as 4 ints
-    uint8_t     c[16];      // target MD5 sum as 16 chars
+struct idxent {
+    uint32_t    word;       // A word of the substring's sum
+    uint32_t    offset;     // where the substring is in the data set
 };
 
     /* Macros to make reading the MD5 computation easier */
@@ -101,20 +323,195 @@ union targetmd5 {
 
 #define ROTATE(a, s) ((a << s) + (a >> (32 - s)))
 
+    /* A kernel computes the sums of the 'lanes' substrings that
+     * start at data[0] through data[lanes-1] and returns a bitmask of
+     * the lanes whose first word may be one of the targets in 't'.
+     * When that is non-zero the first words of the sums are returned
+     * in H[0..lanes-1], followed by the second words and so on for
+     * all of the hash's words. */
+typedef uint32_t (*vmd5fn)(const char *data, uint32_t H[], const struct targetset *t);
+
+    /* A gather kernel does the same for the substrings that start at
+     * data[off[0]] through data[off[n-1]], where n is the number of
+     * substrings the vmd5fn kernel for 'sublen' hashes per call. */
+typedef uint32_t (*vmd5xfn)(const char *data, const int32_t off[], uint32_t H[],
+                            const struct targetset *t, int sublen);
+
+    /* A kernel for the interleaved copy of the data set hashes the
+     * substrings that start at byte 'start' and the next few bytes of
+     * every stream, with the words of the streams in 'rows'. */
+typedef uint32_t (*vsoafn)(const uint32_t *rows, long start, uint32_t H[],
+                           const struct targetset *t);
+
+    /* The kernels for one instruction set */
+struct vkernel {
+    const char *name;       // instruction set name as given to -k
+    int         lanes;      // vector lanes
+    int         sets;       // sets of lanes a one block kernel hashes per
+                            // call; two block kernels hash two sets
+    vmd5fn     *tab;        // kernels indexed by substring length
+    vmd5xfn     gather;     // kernel for substrings at any offsets
+    vsoafn     *soa;        // kernels for the interleaved copy by length, or NULL
+    int         soapos;     // start positions in each stream they hash per call
+};
+
+    /* A hash the search can look for.  Its kernels all take the
+     * message in 64 byte blocks padded as MD5 does it, with the end
+     * bit after the string and the length in bits at the end of the
+     * last block, so one or two blocks covers every substring length.
+     * What differs is the word order of the message and the sum,
+     * which 'bigendian' gives, and how many words the sum has. */
+struct hashalg {
+    const char *name;       // hash name as given to -H
+    const char *label;      // and as printed
+    int         nwords;     // 32 bit words in a sum
+    int         bigendian;  // the sum's words are printed big endian
+    struct vkernel *kernels; // its kernels, NKERNELS of them, fastest first
+    void      (*ref)(const char *, int, uint32_t []); // plain one lane version
+};
+
 
 
 /************************** GLOBAL VARIABLES ***********************/
 int         Nthread;        // number of threads working on the file list 
 THRDINFO    Thrds [MXTHRD]; // table of thread indicies
-union targetmd5 Findme;     // the md5 sum to locate
+struct targetset Targets;   // the sums to locate
+struct hashalg *Hash;       // the hash they are sums of (-H)
 char       *Dataset;        // All files copied to shared memory
 int         Fdshm;          // file descriptor for shared memory
 int         Shmlen;         // length of the shared memory segment
+int         Sublen;         // length of the target substring
+vmd5fn      Vmd5;           // kernel specialized for Sublen
+vmd5xfn     Vmd5x;          // gather kernel for the leftover substrings
+int         Lanes;          // number of substrings Vmd5 hashes per call
+int         Sweepmax;       // search every length from Sublen to this (-l min-max), or 0
+vmd5fn      Sweepfn[MAXSUBLEN + 1]; // the kernel for each length of the sweep
+int         Sweeplanes[MAXSUBLEN + 1]; // and the number of sums it computes
+int         Datalen;        // length of the data set without the pad
+int         Ncand;          // number of substring start offsets to hash
+int         Nchunks;        // number of chunks in Ncand
+int         Chunksz = CHUNKSZ; // substring starts in a chunk, from the profile
+int         Chunkpos;       // stream positions in a chunk of the interleaved copy
+int         Nextchunk;      // next chunk to hand out, taken atomically
+int         Stop;           // set to stop the threads early
+int         Allmatch;       // report every match, not just the first (-a)
+int         Pin;            // pin threads to cpus (-p), 2 for one per core (from -T)
+int         Replicate;      // make a copy of the data set on each node (-r)
+int         Nnodes;         // number of entries in Nodes
+NUMANODE    Nodes[MAXNODES]; // the NUMA nodes we can run on
+long        Nmatch;         // number of matches reported
+pthread_mutex_t Outlock = PTHREAD_MUTEX_INITIALIZER; // serializes match output
+struct provhdr *Prov;       // where the data set came from, or NULL
+long        Provlen;        // length of the mapping at Prov
+char       *Provnames;      // the file names in Prov
+struct provrun *Provruns;   // the runs in Prov
+uint32_t   *Provrefs;       // the file references in Prov
+struct lineshdr *Lineshdr;  // the line index, or NULL to look for the nulls
+struct soahdr *Soa;         // the interleaved copy of the data set, or NULL
+long        Soalen;         // length of the mapping at Soa
+const uint32_t *Soarows;    // its rows
+vsoafn      Vsoa;           // kernel for it this search, or NULL to scan Dataset
+int         Soavl;          // lanes in each of Vsoa's vectors
+int         Soapos;         // and positions in each stream it hashes per call
+struct vkernel *Kern;       // the kernels we are using
+long        Lineslen;       // length of the mapping at Lineshdr
+struct lineent *Lines;      // the lines in it
+long        Nlines;         // and how many there are
+struct statshdr *Stats;     // the stats segment
+struct statslot *Slots;     // the threads' counters in it
+char        Statsname[64];  // its name
+long        Statslen;       // and length
+double      Interval;       // seconds between progress reports (-s), or 0
+int         Ndone;          // threads that have finished, taken atomically
+FILE       *Out;            // where matches and results are printed
+char       *Daemon;         // socket to serve queries on (-d), or NULL
+int         Bound;          // we made the socket at Daemon and must remove it
+int         Generation;     // bumped to start the worker pool on a query
+int         Quit;           // set to make the worker pool exit
+pthread_mutex_t Poollock = PTHREAD_MUTEX_INITIALIZER; // guards Generation and Quit
+pthread_cond_t Poolwake = PTHREAD_COND_INITIALIZER;   // the workers wait here for a query
+pthread_cond_t Pooldone = PTHREAD_COND_INITIALIZER;   // and the daemon for the workers
+struct idxent *Ixtmp;       // entries in data set order while building an index (-w)
+long       *Ixchunk;        // index in Ixtmp of each chunk's first entry
+__thread struct idxent *Ixnext; // where this thread puts its next entry
+__thread HITBUF *Myhits;    // this thread's prefix search hits (-m)
+char       *Indexfile;      // digest index to answer queries from (-i), or NULL
+struct idxhdr *Index;       // it, mapped, or NULL
+long        Indexlen;       // length of the mapping at Index
+uint32_t   *Ixbucket;       // the bucket table in Index
+struct idxent *Ixent;       // and the entries
+char       *Streamlist;     // file list to read instead of /gutenberg (-F), or NULL
+long        Baseoff;        // offset in the data set of Dataset[0]
+struct provhdr Streamprov;  // stands in for PROVSHM while streaming
+int         Endchunk;       // the threads take chunks up to this one
+char       *Coordport;      // port to coordinate workers on (-C), or NULL
+char       *Coordinator;    // host:port of the coordinator to work for (-W), or NULL
+int         Coordfd;        // connection to it
 
 
 /************************* FORWARD REFERENCES **********************/
+void usage(const char *, const char *, ...);
+void cleanup();
+void on_signal(int);
 void *do_vshm(void *);
-int vmd5_19(union v8ui X[], union targetmd5);
+void *do_worker(void *);
+void start_search();
+void start_chunks();
+void start_threads(void *(*)(void *));
+void end_search();
+void run_search();
+void wake_pool();
+void wait_pool();
+void stop_pool();
+void print_results();
+void run_daemon(struct vkernel *);
+void stream_search();
+int fill_window(STREAM *, WINDOW *);
+void run_coordinator();
+void run_worker(struct vkernel *);
+int take_line(LINEBUF *, char *);
+int read_line(LINEBUF *, char *);
+void write_all(int, const char *, long);
+int read_query(FILE *, int, union targetsum **, int *, int *, int *);
+int run_bench(struct vkernel *, int, long, int, int, int);
+void profile_path(char *);
+void load_profile(char **);
+void save_profile(const char *, int, int, int);
+int run_tune(int);
+double tune_trial();
+struct vkernel *pick_kernel(const char *);
+int kernel_lanes(struct vkernel *, int);
+int parse_sum(const char *, union targetsum *);
+int parse_mask(const char *, union targetsum *, union targetsum *);
+void load_targets(const char *, union targetsum *);
+void build_targets(union targetsum *, int);
+void free_targets();
+void print_sum(union targetsum *);
+static inline int probe_target(const uint32_t [], int, int);
+void report_match(int, const char *, int, long);
+void report_hit(const uint32_t [], int, int, const char *, int, long);
+void flush_hits(HITBUF *);
+void load_prov();
+void load_lines();
+void load_soa();
+void print_prov(long);
+void build_index(const char *);
+void load_index(const char *);
+void lookup_index();
+uint64_t data_fingerprint();
+struct hashalg *pick_hash(const char *);
+extern struct hashalg Hashes[];
+void scan_chunk(int, const char *, int, vmd5fn, int, uint32_t *, struct statslot *);
+void scan_lines(int, const char *, int, vmd5fn, int, uint32_t *, struct statslot *);
+void scan_soa(int, const char *, uint32_t *, struct statslot *);
+void make_stats(int);
+void report_progress();
+void print_summary();
+uint64_t now_ns();
+void find_nodes();
+int read_cpulist(const char *, cpu_set_t *);
+void place_threads();
+void make_replicas();
 
 
 
@@ -122,50 +519,272 @@ int vmd5_19(union v8ui X[], union targetmd5);
 int main(int argc, char *argv[])
 {
     int          i;           // generic loop counter
-    char         c;           // generic char varible
-    int          hex;         // hex digit in the input sum
+    int          opt;         // command line option from getopt()
     int          ret;         // generic int return value from a system call
     int         *vret;        // generic void pointer return value from a system call
     struct stat  shmstat;     // info about the shared memory segment
+    char        *digestfile;  // file of target sums given with -f
+    char        *kname;       // instruction set given with -k
+    char        *hname;       // hash given with -H
+    struct vkernel *kern;     // the kernels we will use
+    union targetsum findme;   // target sum given on the command line
+    int          nsum;        // number of sums given on the command line
+    int          bench;       // run the benchmark (-b)
+    long         benchmb;     // size of its corpus in MB
+    int          minline;     // shortest line in the corpus
+    int          maxline;     // longest line in the corpus
+    int          lset;        // substring length given with -l
+    char        *buildindex;  // index file to build (-w), or NULL
+    int          tune;        // tune this host and save the profile (-T)
+    char        *pattern;     // sum prefix or value:mask to search for (-m), or NULL
+    union targetsum mask;     // the bits of it to compare
+    int          usesoa;      // search the interleaved copy if it fits (-S)
+
+    digestfile = NULL;
+    kname = NULL;
+    hname = NULL;
+    Sublen = DEFSUBLEN;
+    bench = 0;
+    lset = 0;
+    buildindex = NULL;
+    tune = 0;
+    pattern = NULL;
+    usesoa = 0;
+    Out = stdout;
+    while ((opt = getopt(argc, argv, "ab:C:d:f:F:H:i:k:l:m:prs:STw:W:")) != -1) {
+        switch (opt) {
+        case 'a':
+            Allmatch = 1;
+            break;
+        case 'b':
+            bench = 1;
+            minline = 10;
+            maxline = 75;
+            if ((sscanf(optarg, "%ld,%d,%d", &benchmb, &minline, &maxline) < 1) ||
+                (benchmb <= 0) || (minline < 0) || (maxline < minline)) {
+                benchmb = 0;
+            }
+            break;
+        case 'C':
+            Coordport = optarg;
+            break;
+        case 'd':
+            Daemon = optarg;
+            break;
+        case 'f':
+            digestfile = optarg;
+            break;
+        case 'F':
+            Streamlist = optarg;
+            break;
+        case 'H':
+            hname = optarg;
+            break;
+        case 'i':
+            Indexfile = optarg;
+            break;
+        case 'k':
+            kname = optarg;
+            break;
+        case 'l':
+            if (sscanf(optarg, "%d-%d", &Sublen, &Sweepmax) < 1) {
+                Sublen = 0;
+            }
+            lset = 1;
+            break;
+        case 'm':
+            pattern = optarg;
+            break;
+        case 'p':
+            Pin = 1;
+            break;
+        case 'r':
+            Pin = 1;
+            Replicate = 1;
+            break;
+        case 's':
+            if ((sscanf(optarg, "%lf", &Interval) != 1) || (Interval <= 0)) {
+                Interval = 0;
+            }
+            break;
+        case 'S':
+            usesoa = 1;
+            break;
+        case 'T':
+            tune = 1;
+            break;
+        case 'w':
+            buildindex = optarg;
+            break;
+        case 'W':
+            Coordinator = optarg;
+            break;
+        default:
+            usage(argv[0], NULL);
+        }
+    }
 
     /* sanity check */
-    if ((argc !=  3) ||
-        (sscanf(argv[1], "%d", &Nthread) != 1) ||
-        (Nthread <= 0) || (Nthread >= MXTHRD) ||
-        (Sublen < 19) || (Sublen > 55)) {
-        printf("Usage: %s <Num-threads> <target MD5 sum>\n", argv[0]);
-        exit(1);
+    nsum = argc - optind - 1;
+    if ((nsum < 0) || (nsum > 1)) {
+        usage(argv[0], NULL);
+    }
+    if ((sscanf(argv[optind], "%d", &Nthread) != 1) || (Nthread < 0) ||
+        (Nthread >= ((Coordport != NULL) ? MAXPEERS : MXTHRD))) {
+        usage(argv[0], "The number of threads must be between 0 and %d\n",
+              ((Coordport != NULL) ? MAXPEERS : MXTHRD) - 1);
     }
-    if ((2 * MD5_DIGEST_LENGTH) != strnlen(argv[2], MD5_DIGEST_LENGTH +100)) { 
-        printf("Invalid target MD5 sum length\n");
-        printf("Usage: %s <num-threads> <MD5 checksum to locate>\n", argv[0]);
+    if ((Nthread == 0) && ((Coordport != NULL) || bench || tune)) {
+        usage(argv[0], "The number of threads must be given with -b, -C and -T\n");
+    }
+    if ((Sublen < MINSUBLEN) || (Sublen > MAXSUBLEN) ||
+        ((Sweepmax != 0) && ((Sweepmax < Sublen) || (Sweepmax > MAXSUBLEN)))) {
+        usage(argv[0], "The substring length must be between %d and %d\n", MINSUBLEN, MAXSUBLEN);
+    }
+    if ((nsum == 0) && (digestfile == NULL) && (bench == 0) && (Daemon == NULL) &&
+        (buildindex == NULL) && (Coordinator == NULL) && (tune == 0) && (pattern == NULL)) {
+        usage(argv[0], "Give a target sum or one of -f, -m, -b, -d, -w, -W and -T\n");
+    }
+    if (bench && (benchmb == 0)) {
+        usage(argv[0], "Give -b as MB[,min-line,max-line]\n");
+    }
+    if ((pattern != NULL) && ((nsum != 0) || (digestfile != NULL) || bench || tune ||
+                              (Daemon != NULL) || (buildindex != NULL) || (Indexfile != NULL) ||
+                              (Coordport != NULL) || (Coordinator != NULL))) {
+        usage(argv[0], "-m cannot be used with a target sum or -f, -b, -T, -d, -w, -i, -C or -W\n");
+    }
+    if (tune && (bench || (Daemon != NULL) || (buildindex != NULL) || (Indexfile != NULL) ||
+                 (Streamlist != NULL) || (Coordport != NULL) || (Coordinator != NULL) ||
+                 Replicate || (Sweepmax != 0))) {
+        usage(argv[0], "-T cannot be used with -b, -d, -w, -i, -F, -C, -W, -r or a range of lengths\n");
+    }
+    if ((Daemon != NULL) && ((nsum != 0) || (digestfile != NULL) || bench)) {
+        usage(argv[0], "-d takes its targets from its queries, not a target sum, -f or -b\n");
+    }
+    if ((buildindex != NULL) && ((nsum != 0) || (digestfile != NULL) || bench ||
+                                 (Daemon != NULL) || (Indexfile != NULL))) {
+        usage(argv[0], "-w cannot be used with a target sum or -f, -b, -d or -i\n");
+    }
+    if ((Streamlist != NULL) && (bench || (Daemon != NULL) || (buildindex != NULL) ||
+                                 (Indexfile != NULL) || Replicate)) {
+        usage(argv[0], "-F cannot be used with -b, -d, -w, -i or -r\n");
+    }
+    if ((Coordport != NULL) && (bench || (Daemon != NULL) || (buildindex != NULL) ||
+                                (Indexfile != NULL) || (Streamlist != NULL) ||
+                                (Coordinator != NULL))) {
+        usage(argv[0], "-C cannot be used with -b, -d, -w, -i, -F or -W\n");
+    }
+    if ((Coordinator != NULL) && ((nsum != 0) || (digestfile != NULL) || bench ||
+                                  (Daemon != NULL) || (buildindex != NULL) ||
+                                  (Indexfile != NULL) || (Streamlist != NULL))) {
+        usage(argv[0], "-W takes its targets from the coordinator, and cannot be used with\n"
+              "a target sum or -f, -b, -d, -w, -i or -F\n");
+    }
+    if (usesoa && (bench || (buildindex != NULL) || (Streamlist != NULL) ||
+                   (Coordport != NULL) || (Coordinator != NULL))) {
+        usage(argv[0], "-S cannot be used with -b, -w, -F, -C or -W\n");
+    }
+    if ((Sweepmax != 0) && (bench || (Daemon != NULL) || (buildindex != NULL) ||
+                            (Indexfile != NULL) || (Coordport != NULL) || (Coordinator != NULL))) {
+        usage(argv[0], "A range of lengths cannot be used with -b, -d, -w, -i, -C or -W\n");
+    }
+    /* Remove the stats segment and the daemon's socket however we end */
+    atexit(cleanup);
+    (void) signal(SIGINT, on_signal);
+    (void) signal(SIGTERM, on_signal);
+    (void) signal(SIGHUP, on_signal);
+    (void) signal(SIGPIPE, on_signal);
+
+    Hash = pick_hash(hname);
+    if ((pattern != NULL) && (parse_mask(pattern, &findme, &mask) != 0)) {
+        printf("Give -m as a hex prefix of the sum, optionally with /bits to compare fewer of\n"
+               "its bits, or as value:mask, both in hex\n");
         exit(1);
     }
-    for (i = 0; i < (2 * MD5_DIGEST_LENGTH); i++) {
-        if (isxdigit(argv[2][i]) == 0) {
-            printf("Invalid target MD5 sum character '%c'\n", argv[2][i]);
-            printf("Usage: %s <num-threads> <MD5 checksum to locate>\n", argv[0]);
-            exit(1);
+    if ((nsum == 1) && (parse_sum(argv[optind + 1], &findme) != 0)) {
+        usage(argv[0], NULL);
+    }
+
+    /* Take what -T found best for this host unless told otherwise.  A
+     * thread count of 0 asks for the profile's, or one per cpu. */
+    if (!tune && !bench) {
+        load_profile(&kname);
+    }
+    if (Nthread == 0) {
+        Nthread = (int) sysconf(_SC_NPROCESSORS_ONLN);
+        if (Nthread >= MXTHRD) {
+            Nthread = MXTHRD - 1;
         }
     }
-    /* At this point we know that there are three arguments and the third
-     * one has the length of an MD5 sum, and has only hex characters in in. */
+    kern = pick_kernel(kname);
+    Kern = kern;
 
-    /* Put the sum from the command line into an array */
-    Findme.i[0] = Findme.i[1] = Findme.i[2] = Findme.i[3] = 0;
-    for (i = 0 ; i < MD5_DIGEST_LENGTH; i++) {
-        c = tolower(argv[2][(2 * i)]);
-        if (c <= '9')
-            hex = (int)(c - '0');
-        else
-            hex = 10 + (int)(c - 'a');
-        Findme.c[i] = hex << 4;
-        c = tolower(argv[2][(2 * i) + 1]);
-        if (c <= '9')
-            hex = (int)(c - '0');
-        else
-            hex = 10 + (int)(c - 'a');
-        Findme.c[i] = Findme.c[i] + hex;
+    /* The benchmark and the tuner look for a sum that is not there
+     * unless told otherwise */
+    if (tune && (nsum == 0) && (digestfile == NULL)) {
+        memset(&findme, 0xff, sizeof(findme));
+        nsum = 1;
+    }
+    if (bench) {
+        if ((nsum == 0) && (digestfile == NULL)) {
+            memset(&findme, 0xff, sizeof(findme));
+            nsum = 1;
+        }
+        load_targets(digestfile, (nsum == 1) ? &findme : NULL);
+        make_stats(Nthread);
+        ret = run_bench((kname != NULL) ? kern : NULL, lset, benchmb, minline, maxline, Nthread);
+        (void) shm_unlink(Statsname);
+        exit(ret);
+    }
+
+    Vmd5 = kern->tab[Sublen];
+    Vmd5x = kern->gather;
+    Lanes = kernel_lanes(kern, Sublen);
+    if (Sweepmax == Sublen) {
+        Sweepmax = 0;
+    }
+    for (i = Sublen; i <= Sweepmax; i++) {
+        Sweepfn[i] = kern->tab[i];
+        Sweeplanes[i] = kernel_lanes(kern, i);
+    }
+    if (Sweepmax != 0) {
+        printf("Searching every length from %d to %d\n", Sublen, Sweepmax);
+    }
+
+    /* Build the set of target sums from the file and/or command line.
+     * The daemon and the workers get their targets with each query,
+     * and building an index has none. */
+    if (pattern != NULL) {
+        load_targets(NULL, &findme);
+        Targets.mask = &mask;
+        Allmatch = 1;
+        printf("Searching for every %s sum matching %s\n", Hash->label, pattern);
+    }
+    else if ((Daemon == NULL) && (buildindex == NULL) && (Coordinator == NULL)) {
+        load_targets(digestfile, (nsum == 1) ? &findme : NULL);
+        if (Targets.count > 1) {
+            printf("Searching for %d target %s sums\n", Targets.count, Hash->label);
+        }
+    }
+
+    /* The coordinator leaves the searching to its workers */
+    if (Coordport != NULL) {
+        run_coordinator();
+        print_results();
+        exit(0);
+    }
+
+    /* Read the files as we search them rather than mapping /gutenberg */
+    if (Streamlist != NULL) {
+        find_nodes();
+        place_threads();
+        make_stats(Nthread);
+        stream_search();
+        print_summary();
+        print_results();
+        munmap(Stats, Statslen);
+        (void) shm_unlink(Statsname);
+        exit(0);
     }
 
     /* Open the shared memory segment /gutenberg and map into our address space */
@@ -192,223 +811,3982 @@ int main(int argc, char *argv[])
     }
     Dataset = (char *) vret;
 
-    /* Create n threads */
+    /* Ask for transparent huge pages to cut TLB misses on the scan.
+     * This only has an effect if /dev/shm allows huge pages. */
+    (void) madvise(Dataset, Shmlen, MADV_HUGEPAGE);
+
+    /* Decide where the threads run and which copy of the data they scan */
+    find_nodes();
+    place_threads();
+    if (Replicate) {
+        make_replicas();
+    }
+
+    /* Search the data set up to the pad, or serve queries on it */
+    Datalen = Shmlen - DATAPAD;
+    load_prov();
+    load_lines();
+    if (usesoa) {
+        load_soa();
+    }
+    make_stats(Nthread);
+    if (tune) {
+        ret = run_tune(Nthread);
+        munmap(Stats, Statslen);
+        (void) shm_unlink(Statsname);
+        exit(ret);
+    }
+    if (Indexfile != NULL) {
+        load_index(Indexfile);
+    }
+    if (buildindex != NULL) {
+        build_index(buildindex);
+    }
+    else if (Daemon != NULL) {
+        run_daemon(kern);
+    }
+    else if (Coordinator != NULL) {
+        run_worker(kern);
+    }
+    else {
+        if ((Index != NULL) && (Index->sublen == (uint32_t) Sublen)) {
+            lookup_index();
+        }
+        else {
+            if (Index != NULL) {
+                printf("Index %s is for length %u, searching instead\n", Indexfile, Index->sublen);
+            }
+            run_search();
+            print_summary();
+        }
+        print_results();
+    }
+
+    /* clean up and exit */
+    for (i = 0; i < Nnodes; i++) {
+        if ((Nodes[i].data != NULL) && (Nodes[i].data != Dataset)) {
+            munmap(Nodes[i].data, Nodes[i].datasz);
+        }
+    }
+    if (Prov != NULL) {
+        munmap(Prov, Provlen);
+    }
+    if (Lineshdr != NULL) {
+        munmap(Lineshdr, Lineslen);
+    }
+    if (Soa != NULL) {
+        munmap(Soa, Soalen);
+    }
+    if (Index != NULL) {
+        munmap(Index, Indexlen);
+    }
+    munmap(Stats, Statslen);
+    (void) shm_unlink(Statsname);
+    munmap(Dataset, Shmlen);
+    close(Fdshm);
+    exit(0);
+}
+
+
+/*
+ * usage() : print how to run the program and, unless 'why' is NULL,
+ * the printf() format 'why' filled in with the rest of the arguments
+ * to say what was wrong, and exit.
+ */
+void usage(const char *prog, const char *why, ...)
+{
+    va_list       ap;          // the arguments for why
+
+    printf("Usage: %s [-a] [-b MB[,min-line,max-line]] [-C port] [-d socket] [-f digest-file] [-F file-list] [-H hash] [-i index-file] [-k kernel] [-l substring-length[-max-length]] [-m prefix[/bits] | -m value:mask] [-p] [-r] [-s seconds] [-S] [-T] [-w index-file] [-W host:port] <Num-threads> [target sum]\n", prog);
+    if (why != NULL) {
+        va_start(ap, why);
+        vprintf(why, ap);
+        va_end(ap);
+    }
+    exit(1);
+}
+
+
+/*
+ * cleanup() : remove the stats segment and the daemon's socket, if we
+ * made them.  It is called at exit and when a signal ends us.
+ */
+void cleanup()
+{
+    if (Statsname[0] != (char) 0) {
+        (void) shm_unlink(Statsname);
+    }
+    if (Bound) {
+        (void) unlink(Daemon);
+    }
+}
+
+
+/*
+ * on_signal() : stop the threads, clean up and end the way 'sig' would
+ * have ended us.  The daemon and the workers ignore SIGPIPE, so only a
+ * closed stdout gets here with it.
+ */
+void on_signal(int sig)
+{
+    __atomic_store_n(&Stop, 1, __ATOMIC_RELAXED);
+    Quit = 1;
+    cleanup();
+    (void) signal(sig, SIG_DFL);
+    (void) raise(sig);
+}
+
+
+/*
+ * run_search() : have Nthread threads, pinned to their cpus if asked,
+ * search the data set, with progress reports every Interval seconds
+ * if -s was given.  Return when the chunks run out, or early when the
+ * last target is found (unless -a).
+ */
+void run_search()
+{
+    int          i;           // generic loop counter
+
+    start_search();
+    start_threads(do_vshm);
+    if (Interval > 0) {
+        report_progress();
+    }
     for (i = 0; i < Nthread; i++) {
-        Thrds[i].thread_idx = i;
-        ret = pthread_create( &(Thrds[i].thread_id), NULL, do_vshm,
-              (void *) &(Thrds[i].thread_idx));
+        pthread_join(Thrds[i].thread_id, NULL);
+    }
+    end_search();
+}
+
+
+/*
+ * start_search() : cut the data set into chunks for the threads and
+ * clear the counters.  The interleaved copy is searched instead of
+ * the data set if there is one and it has a kernel for Sublen.
+ */
+void start_search()
+{
+    Vsoa = NULL;
+    if ((Soa != NULL) && (Kern->soa != NULL) && (Sublen <= MAXONEBLK) && (Sweepmax == 0)) {
+        Vsoa = Kern->soa[Sublen];
+        Soavl = Kern->lanes;
+        Soapos = Kern->soapos;
+    }
+    start_chunks();
+    Stop = 0;
+    memset(Slots, 0, Nthread * sizeof(struct statslot));
+    Stats->nthread = Nthread;
+    Stats->sublen = Sublen;
+    Stats->nchunks = Nchunks;
+    Stats->start = now_ns();
+    Stats->updated = Stats->start;
+    Stats->done = 0;
+}
+
+
+/*
+ * start_chunks() : cut the substring start offsets of the Datalen
+ * bytes at Dataset, or of the streams of the interleaved copy, into
+ * chunks for the threads.  A position in the interleaved copy starts
+ * a substring in every stream, so its chunks have SOASTREAMS times
+ * fewer positions to hash about as many substrings.
+ */
+void start_chunks()
+{
+    /* A substring must end before the pad.  In the interleaved copy
+     * the candidates are the start positions in each stream, and the
+     * tuner's slice of the data set, when Datalen is cut short, is the
+     * same share of each stream. */
+    Ncand = Datalen - Sublen + 1;
+    if (Ncand < 0) {
+        Ncand = 0;
+    }
+    Nchunks = (Ncand + Chunksz - 1) / Chunksz;
+    if (Vsoa != NULL) {
+        Ncand = Soa->step;
+        if ((uint64_t) Datalen < Soa->datalen) {
+            Ncand = (Soa->step * Datalen) / Soa->datalen;
+        }
+        Chunkpos = ((Chunksz / SOASTREAMS) / Soapos) * Soapos;
+        if (Chunkpos == 0) {
+            Chunkpos = Soapos;
+        }
+        Nchunks = (Ncand + Chunkpos - 1) / Chunkpos;
+    }
+    Nextchunk = 0;
+    Endchunk = Nchunks;
+    Ndone = 0;
+}
+
+
+/*
+ * start_threads() : start Nthread threads running 'fn', each pinned to
+ * its cpu if asked and given its entry in Thrds.
+ */
+void start_threads(void *(*fn)(void *))
+{
+    int          i;           // generic loop counter
+    int          ret;         // return value from pthread_create()
+    pthread_attr_t attr;      // thread attributes, for pinning
+    cpu_set_t    cpus;        // cpu a thread is pinned to
+
+    for (i = 0; i < Nthread; i++) {
+        Thrds[i].stats = &Slots[i];
+        pthread_attr_init(&attr);
+        if (Thrds[i].cpu >= 0) {
+            CPU_ZERO(&cpus);
+            CPU_SET(Thrds[i].cpu, &cpus);
+            pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+        }
+        ret = pthread_create( &(Thrds[i].thread_id), &attr, fn,
+              (void *) &(Thrds[i]));
         if(ret != 0) {
             fprintf(stderr,"Error - pthread_create() return code: %d\n", ret);
             exit(-1);
         }
+        pthread_attr_destroy(&attr);
     }
+}
 
-    /* Wait for the threads to return.  If a thread finds a match it will print the
-     * matching string and call exit().  We only get to the bottom of the joins if
-     * the target string was not in the text files. */
-    for (i = 0; i < Nthread; i++) {
-        pthread_join(Thrds[i].thread_id, NULL);
-    }
-    printf("Target MD5 sum is not found\n");
 
-    exit(0);
+/*
+ * end_search() : mark the search over in the stats segment.
+ */
+void end_search()
+{
+    Stats->updated = now_ns();
+    __atomic_store_n(&Stats->done, 1, __ATOMIC_RELEASE);
 }
 
 
+/*
+ * wake_pool() : start the worker pool on the chunks set up by
+ * start_chunks().
+ */
+void wake_pool()
+{
+    pthread_mutex_lock(&Poollock);
+    Generation++;
+    pthread_cond_broadcast(&Poolwake);
+    pthread_mutex_unlock(&Poollock);
+}
+
 
 /*
- * do_vshm() : search for the Findme md5 sum
+ * wait_pool() : wait for every worker to run out of chunks.
  */
-void *do_vshm(void *pidx)
+void wait_pool()
 {
-    int           myidx;       // our thread index
-    char         *mydata;      // where we start scanning
-    int           mylen;       // how many bytes we should scan
-    int           cinx;        // index into data of the shm
-    int           i,j;         // generic loop index
-    union v8ui X[16];          // Eight 512 bit vectors of input strings
-    int           match;       // index of a matching string
-    uint32_t      maskor;      // mask onto end of string
-    uint32_t      maskand;     // mask from end of string
+    pthread_mutex_lock(&Poollock);
+    while (__atomic_load_n(&Ndone, __ATOMIC_ACQUIRE) < Nthread) {
+        pthread_cond_wait(&Pooldone, &Poollock);
+    }
+    pthread_mutex_unlock(&Poollock);
+}
 
 
-    // The input string
-    (void) memset((void *)X, 0, (size_t)(16 * sizeof(union v8ui)));
-    X[14].s[0] = X[14].s[1] = X[14].s[2] = X[14].s[3] = \
-    X[14].s[4] = X[14].s[5] = X[14].s[6] = X[14].s[7] = Sublen * 8 ;
+/*
+ * stop_pool() : tell the workers to exit and wait for them.
+ */
+void stop_pool()
+{
+    int          i;           // generic loop counter
 
+    pthread_mutex_lock(&Poollock);
+    Quit = 1;
+    Generation++;
+    pthread_cond_broadcast(&Poolwake);
+    pthread_mutex_unlock(&Poollock);
+    for (i = 0; i < Nthread; i++) {
+        pthread_join(Thrds[i].thread_id, NULL);
+    }
+}
 
-    myidx = *((int *)pidx);
 
-    /* The dataset at Dataset is of length Shmlen.  This length is
-     * actually padded with 100 bytes (at the bottom of shm_init.c).
-     * Our thread want to process (Shmlen -100) / Nthread characters
-     * but we also want to scan a little into the next thread's 
-     * data (or into the pad if the last thread). */
+/*
+ * print_results() : print to Out the match count (-a, -m) and the
+ * targets that were not found.
+ */
+void print_results()
+{
+    int          i;           // generic loop counter
 
-    mydata = Dataset + myidx * ((Shmlen -100) / Nthread);
-    mylen  = ((Shmlen -100) / Nthread) + Sublen; 
-    // compute end of messsage bit
-    if (Sublen % 4 == 3) {
-        maskand = 0x00FFFFFF;
-        maskor = 0x80000000;
+    if (Allmatch) {
+        fprintf(Out, "Found %ld matches\n", Nmatch);
     }
-    else if (Sublen % 4 == 2) {
-        maskand = 0x0000FFFF;
-        maskor = 0x00800000;
+    if ((Targets.count == 1) && (Targets.found == 0) && (Targets.mask == NULL)) {
+        fprintf(Out, "Target %s sum is not found\n", Hash->label);
     }
-    else if (Sublen % 4 == 1) {
-        maskand = 0x000000FF;
-        maskor = 0x00008000;
+    else if (Targets.count > 1) {
+        for (i = 0; i < Targets.count; i++) {
+            if (Targets.done[i] == 0) {
+                print_sum(&Targets.sums[i]);
+                fprintf(Out, " not found\n");
+            }
+        }
+        fprintf(Out, "Found %d of %d target %s sums\n", Targets.found, Targets.count,
+                Hash->label);
     }
-    else {
-        maskand = 0x00000000;
-        maskor = 0x00000080;
+}
+
+
+/*
+ * run_daemon() : serve queries on the Unix domain socket Daemon until
+ * one asks us to shut down.  The data set stays mapped and a pool of
+ * Nthread workers, pinned if asked, waits between queries, so a query
+ * costs only the scan.  A client sends one or more queries (see
+ * read_query()) on a connection; for each one the matches and results
+ * are written back as shm_vec_md5 prints them, with offsets, followed
+ * by a line "done".  Queries are run one at a time, each using all of
+ * the workers, or looked up in the digest index (-i) if it is for the
+ * query's length.
+ */
+void run_daemon(struct vkernel *kern)
+{
+    int           lfd;         // the listening socket
+    int           cfd;         // a client's connection
+    struct sockaddr_un addr;   // the socket's name
+    FILE         *in;          // queries from the client
+    union targetsum *sums;     // the sums of a query
+    int           nsum;        // how many there are
+    int           len;         // substring length of the query
+    int           all;         // report every match
+    int           q;           // what read_query() found
+    int           deflen;      // substring length of queries that do not give one
+
+    deflen = Sublen;
+    (void) signal(SIGPIPE, SIG_IGN);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(Daemon) >= sizeof(addr.sun_path)) {
+        printf("Socket name %s is too long\n", Daemon);
+        exit(1);
+    }
+    strcpy(addr.sun_path, Daemon);
+    (void) unlink(Daemon);
+    lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ((lfd < 0) || (bind(lfd, (struct sockaddr *) &addr, sizeof(addr)) < 0) ||
+        (listen(lfd, 16) < 0)) {
+        printf("Unable to listen on %s\n", Daemon);
+        perror(NULL);
+        exit(1);
     }
+    Bound = 1;
 
-    /* Walk the file processing every Sublen character substring, 8 at a time */
-    for (cinx = 0; cinx < mylen; cinx += 8) {
-        for (i = 0; i < 8; i++) {
-            for (j = 0; j < (Sublen / sizeof(uint32_t)) + 1; j++) { 
-                X[j].s[i] = *((int *)(mydata + cinx + (j * 4) + i));
+    start_threads(do_worker);
+    printf("Serving queries on %s\n", Daemon);
+    fflush(stdout);
+
+    q = QUERY_EOF;
+    while (q != QUERY_QUIT) {
+        cfd = accept(lfd, NULL, NULL);
+        if (cfd < 0) {
+            if (errno == EINTR) {
+                continue;
             }
-            X[j - 1].s[i] &= maskand;
-            X[j - 1].s[i] |= maskor;
+            perror("accept");
+            exit(1);
         }
-        match = vmd5_19(X, Findme);
-        if (match >= 0) {
-            printf("Match with string '");
-            for (i = 0; i < Sublen; i++)
-                putchar(*(mydata + cinx + match + i));
-            printf("'\n");
-            exit(0);
+        in = fdopen(cfd, "r");
+        Out = fdopen(dup(cfd), "w");
+        if ((in == NULL) || (Out == NULL)) {
+            perror("fdopen");
+            exit(1);
         }
+        while ((q = read_query(in, deflen, &sums, &nsum, &len, &all)) != QUERY_EOF) {
+            if (q == QUERY_QUIT) {
+                break;
+            }
+            if ((q == QUERY_OK) && (Index != NULL) && (Index->sublen == (uint32_t) len)) {
+                Sublen = len;
+                Allmatch = all;
+                Nmatch = 0;
+                build_targets(sums, nsum);
+                lookup_index();
+                print_results();
+                free_targets();
+            }
+            else if (q == QUERY_OK) {
+                Sublen = len;
+                Vmd5 = kern->tab[Sublen];
+                Vmd5x = kern->gather;
+                Lanes = kernel_lanes(kern, Sublen);
+                Allmatch = all;
+                Nmatch = 0;
+                build_targets(sums, nsum);
 
-        /* do not scan within Sublen character of a line end */
-        /* Comparisons are unrolled here */
-        for (i = 0; i < 8; i++) {
-            if (*(mydata + cinx + Sublen + i) == (char) 0) {
-                // skip to char after null (+1) backup 8 for cinx+=8
-                cinx = cinx + Sublen + i + 1 - 8;
-                continue;
+                /* wake the workers and wait for them to finish */
+                start_search();
+                wake_pool();
+                if (Interval > 0) {
+                    report_progress();
+                }
+                wait_pool();
+                end_search();
+
+                print_summary();
+                print_results();
+                free_targets();
             }
+            fprintf(Out, "done\n");
+            fflush(Out);
         }
+        fclose(in);
+        fclose(Out);
+        Out = stdout;
     }
+
+    stop_pool();
+    close(lfd);
+    (void) unlink(Daemon);
+    Bound = 0;
 }
 
 
+/*
+ * stream_search() : search the files in Streamlist without loading
+ * them into /gutenberg first.  The main thread reads the files with
+ * pread() and stores their lines in one of two windows as shm_init
+ * would, while the worker pool searches the other window, so reading
+ * each window overlaps hashing the one before it.  Memory use is the
+ * two windows and a read buffer, however big the files are.  Matches
+ * give the offsets and files they would have in /gutenberg built
+ * without a length or -d.  Progress with -s is reported as each
+ * window is done.
+ */
+void stream_search()
+{
+    int           fd;          // the file list
+    struct stat   st;          // its size
+    STREAM        sm;          // where we are in the files
+    WINDOW        win[2];      // the window being searched and the one being filled
+    int           cur;         // index in win of the one being searched
+    int           more;        // there is more to read after win[cur]
+    uint32_t     *refs;        // reference table for Streamprov, file n is refs[n]
+    uint64_t      tlast;       // time of the last progress report
+    uint64_t      t;           // time now
+    uint64_t      hashed;      // substrings hashed so far
+    uint64_t      lasthashed;  // and at the last progress report
+    int           i;           // generic loop index
+
+    fd = open(Streamlist, O_RDONLY);
+    if ((fd < 0) || (fstat(fd, &st) < 0) || (st.st_size == 0) ||
+        ((st.st_size % MAXNAMELEN) != 0)) {
+        printf("Unable to use file list %s, its size must be a multiple of %d\n",
+               Streamlist, MAXNAMELEN);
+        exit(1);
+    }
+    memset(&sm, 0, sizeof(sm));
+    sm.nfiles = st.st_size / MAXNAMELEN;
+    sm.names = mmap((void *) 0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    sm.fd = -1;
+    sm.rawsz = READSZ;
+    sm.raw = malloc(sm.rawsz);
+    refs = malloc(sm.nfiles * sizeof(uint32_t));
+    if ((sm.names == MAP_FAILED) || (sm.raw == NULL) || (refs == NULL)) {
+        printf("Unable to set up to read the files in %s\n", Streamlist);
+        exit(1);
+    }
+    for (i = 0; i < sm.nfiles; i++) {
+        refs[i] = i;
+    }
+    for (i = 0; i < 2; i++) {
+        memset(&win[i], 0, sizeof(WINDOW));
+        win[i].size = WINDOWSZ;
+        win[i].data = malloc(WINDOWSZ + DATAPAD);
+        if (win[i].data == NULL) {
+            printf("Unable to allocate a window of %d bytes\n", WINDOWSZ);
+            exit(1);
+        }
+    }
+
+    /* Matches are reported from the window's table of files */
+    Streamprov.magic = PROVMAGIC;
+    Streamprov.nfiles = sm.nfiles;
+    Prov = &Streamprov;
+    Provnames = sm.names;
+    Provrefs = refs;
+
+    Datalen = 0;
+    start_search();
+    start_threads(do_worker);
+    tlast = Stats->start;
+    lasthashed = 0;
+    cur = 0;
+    more = fill_window(&sm, &win[cur]);
+    while (win[cur].len > 0) {
+        /* hand the window to the workers */
+        Dataset = win[cur].data;
+        Datalen = win[cur].len;
+        Baseoff = win[cur].base;
+        Streamprov.nruns = win[cur].nruns;
+        Provruns = win[cur].runs;
+        for (i = 0; i < Nthread; i++) {
+            Thrds[i].data = Dataset;
+        }
+        start_chunks();
+        Stats->nchunks += Nchunks;
+        wake_pool();
+
+        /* and read the next one while they search it */
+        win[1 - cur].len = 0;
+        if (more) {
+            more = fill_window(&sm, &win[1 - cur]);
+        }
+        wait_pool();
+        if (Stop) {
+            break;
+        }
+        cur = 1 - cur;
+
+        t = now_ns();
+        Stats->updated = t;
+        if ((Interval > 0) && ((t - tlast) / 1e9 >= Interval)) {
+            hashed = 0;
+            for (i = 0; i < Nthread; i++) {
+                hashed += Slots[i].hashed;
+            }
+            fprintf(stderr, "%6.1fs %8.1f MB read, file %d of %d  %8.1f Mhash/s\n",
+                    (t - Stats->start) / 1e9, sm.outoff / 1e6,
+                    (sm.file < sm.nfiles) ? (sm.file + 1) : sm.nfiles, sm.nfiles,
+                    (hashed - lasthashed) / ((t - tlast) / 1e9) / 1e6);
+            tlast = t;
+            lasthashed = hashed;
+        }
+    }
+    stop_pool();
+    end_search();
+
+    if (sm.fd >= 0) {
+        close(sm.fd);
+    }
+    for (i = 0; i < 2; i++) {
+        free(win[i].data);
+        free(win[i].runs);
+    }
+    free(sm.raw);
+    free(refs);
+    munmap(sm.names, st.st_size);
+    Prov = NULL;
+    Dataset = NULL;
+}
+
 
 /*
- * Compute 8 parallel MD5 sums on the 8x32 char input array X.
- * Compare the sums to 'target' and return the index number (0-7)
- * of a string that matches.  Return -1 if no match is found.
- */
-int vmd5_19(union v8ui X[], union targetmd5 target)
-{
-    uint32_t  i;
-    // md5 state for a given chuck
-    union v8ui A;
-    union v8ui B;
-    union v8ui C;
-    union v8ui D;
-    union v8ui a0;
-    union v8ui b0;
-    union v8ui c0;
-    union v8ui d0;
-
-    //Initialize variables:
-    A.s[0] = A.s[1] = A.s[2] = A.s[3] = A.s[4] = A.s[5] = A.s[6] = A.s[7] = 0x67452301;
-    B.s[0] = B.s[1] = B.s[2] = B.s[3] = B.s[4] = B.s[5] = B.s[6] = B.s[7] = 0xefcdab89;
-    C.s[0] = C.s[1] = C.s[2] = C.s[3] = C.s[4] = C.s[5] = C.s[6] = C.s[7] = 0x98badcfe;
-    D.s[0] = D.s[1] = D.s[2] = D.s[3] = D.s[4] = D.s[5] = D.s[6] = D.s[7] = 0x10325476;
-    a0.v = A.v;
-    b0.v = B.v;
-    c0.v = C.v;
-    d0.v = D.v;
-
-
-    /* Round 0 */
-    R0(A.v, B.v, C.v, D.v, X[0].v, 7, 0xd76aa478);
-    R0(D.v, A.v, B.v, C.v, X[1].v, 12, 0xe8c7b756);
-    R0(C.v, D.v, A.v, B.v, X[2].v, 17, 0x242070db);
-    R0(B.v, C.v, D.v, A.v, X[3].v, 22, 0xc1bdceee);
-    R0(A.v, B.v, C.v, D.v, X[4].v, 7, 0xf57c0faf);
-    R0(D.v, A.v, B.v, C.v, X[5].v, 12, 0x4787c62a);
-    R0(C.v, D.v, A.v, B.v, X[6].v, 17, 0xa8304613);
-    R0(B.v, C.v, D.v, A.v, X[7].v, 22, 0xfd469501);
-    R0(A.v, B.v, C.v, D.v, X[8].v, 7, 0x698098d8);
-    R0(D.v, A.v, B.v, C.v, X[9].v, 12, 0x8b44f7af);
-    R0(C.v, D.v, A.v, B.v, X[10].v, 17, 0xffff5bb1);
-    R0(B.v, C.v, D.v, A.v, X[11].v, 22, 0x895cd7be);
-    R0(A.v, B.v, C.v, D.v, X[12].v, 7, 0x6b901122);
-    R0(D.v, A.v, B.v, C.v, X[13].v, 12, 0xfd987193);
-    R0(C.v, D.v, A.v, B.v, X[14].v, 17, 0xa679438e);
-    R0(B.v, C.v, D.v, A.v, X[15].v, 22, 0x49b40821);
-    /* Round 1 */
-    R1(A.v, B.v, C.v, D.v, X[1].v, 5, 0xf61e2562);
-    R1(D.v, A.v, B.v, C.v, X[6].v, 9, 0xc040b340);
-    R1(C.v, D.v, A.v, B.v, X[11].v, 14, 0x265e5a51);
-    R1(B.v, C.v, D.v, A.v, X[0].v, 20, 0xe9b6c7aa);
-    R1(A.v, B.v, C.v, D.v, X[5].v, 5, 0xd62f105d);
-    R1(D.v, A.v, B.v, C.v, X[10].v, 9, 0x02441453);
-    R1(C.v, D.v, A.v, B.v, X[15].v, 14, 0xd8a1e681);
-    R1(B.v, C.v, D.v, A.v, X[4].v, 20, 0xe7d3fbc8);
-    R1(A.v, B.v, C.v, D.v, X[9].v, 5, 0x21e1cde6);
-    R1(D.v, A.v, B.v, C.v, X[14].v, 9, 0xc33707d6);
-    R1(C.v, D.v, A.v, B.v, X[3].v, 14, 0xf4d50d87);
-    R1(B.v, C.v, D.v, A.v, X[8].v, 20, 0x455a14ed);
-    R1(A.v, B.v, C.v, D.v, X[13].v, 5, 0xa9e3e905);
-    R1(D.v, A.v, B.v, C.v, X[2].v, 9, 0xfcefa3f8);
-    R1(C.v, D.v, A.v, B.v, X[7].v, 14, 0x676f02d9);
-    R1(B.v, C.v, D.v, A.v, X[12].v, 20, 0x8d2a4c8a);
-    /* Round 2 */
-    R2(A.v, B.v, C.v, D.v, X[5].v, 4, 0xfffa3942);
-    R2(D.v, A.v, B.v, C.v, X[8].v, 11, 0x8771f681);
-    R2(C.v, D.v, A.v, B.v, X[11].v, 16, 0x6d9d6122);
-    R2(B.v, C.v, D.v, A.v, X[14].v, 23, 0xfde5380c);
-    R2(A.v, B.v, C.v, D.v, X[1].v, 4, 0xa4beea44);
-    R2(D.v, A.v, B.v, C.v, X[4].v, 11, 0x4bdecfa9);
-    R2(C.v, D.v, A.v, B.v, X[7].v, 16, 0xf6bb4b60);
-    R2(B.v, C.v, D.v, A.v, X[10].v, 23, 0xbebfbc70);
-    R2(A.v, B.v, C.v, D.v, X[13].v, 4, 0x289b7ec6);
-    R2(D.v, A.v, B.v, C.v, X[0].v, 11, 0xeaa127fa);
-    R2(C.v, D.v, A.v, B.v, X[3].v, 16, 0xd4ef3085);
-    R2(B.v, C.v, D.v, A.v, X[6].v, 23, 0x04881d05);
-    R2(A.v, B.v, C.v, D.v, X[9].v, 4, 0xd9d4d039);
-    R2(D.v, A.v, B.v, C.v, X[12].v, 11, 0xe6db99e5);
-    R2(C.v, D.v, A.v, B.v, X[15].v, 16, 0x1fa27cf8);
-    R2(B.v, C.v, D.v, A.v, X[2].v, 23, 0xc4ac5665);
-    /* Round 3 */
-    R3(A.v, B.v, C.v, D.v, X[0].v, 6, 0xf4292244);
-    R3(D.v, A.v, B.v, C.v, X[7].v, 10, 0x432aff97);
-    R3(C.v, D.v, A.v, B.v, X[14].v, 15, 0xab9423a7);
-    R3(B.v, C.v, D.v, A.v, X[5].v, 21, 0xfc93a039);
-    R3(A.v, B.v, C.v, D.v, X[12].v, 6, 0x655b59c3);
-    R3(D.v, A.v, B.v, C.v, X[3].v, 10, 0x8f0ccc92);
-    R3(C.v, D.v, A.v, B.v, X[10].v, 15, 0xffeff47d);
-    R3(B.v, C.v, D.v, A.v, X[1].v, 21, 0x85845dd1);
-    R3(A.v, B.v, C.v, D.v, X[8].v, 6, 0x6fa87e4f);
-    R3(D.v, A.v, B.v, C.v, X[15].v, 10, 0xfe2ce6e0);
-    R3(C.v, D.v, A.v, B.v, X[6].v, 15, 0xa3014314);
-    R3(B.v, C.v, D.v, A.v, X[13].v, 21, 0x4e0811a1);
-    R3(A.v, B.v, C.v, D.v, X[4].v, 6, 0xf7537e82);
-    R3(D.v, A.v, B.v, C.v, X[11].v, 10, 0xbd3af235);
-    R3(C.v, D.v, A.v, B.v, X[2].v, 15, 0x2ad7d2bb);
-    R3(B.v, C.v, D.v, A.v, X[9].v, 21, 0xeb86d391);
-
-    //Add this chunk's hash to result so far:
-    A.v = A.v + a0.v;
-    B.v = B.v + b0.v;
-    C.v = C.v + c0.v;
-    D.v = D.v + d0.v;
-
-    for (i = 0; i < 8; i++) {
-        if ((target.i[0] == A.s[i]) && (target.i[1] == B.s[i]) &&
-            (target.i[2] == C.s[i]) && (target.i[3] == D.s[i])) {
-            return(i);
+ * fill_window() : store lines from the files of 'sm' in 'w' until it
+ * is full or the files run out.  As in shm_init, CRs are removed, a
+ * newline or the end of a file ends a line, lines shorter than
+ * MINSUBLEN are dropped and the rest are ended with a null.  Lines too
+ * short for the search length are left to the scanners to pass over,
+ * as they are in /gutenberg loaded without a length.  The window only
+ * grows if a single line does not fit in it.  Return 1 if there is
+ * more to read and 0 at the end of the file list.
+ */
+int fill_window(STREAM *sm, WINDOW *w)
+{
+    char         *line;        // start of the next line in sm->raw
+    char         *nl;          // its end
+    long          len;         // its length without CRs
+    char         *out;         // where it goes in the window
+    char         *name;        // name of the file being opened
+    ssize_t       got;         // bytes read
+    long          i;           // generic loop index
+
+    w->len = 0;
+    w->nruns = 0;
+    w->base = sm->outoff;
+    for (;;) {
+        /* Store the next whole line, if we have one */
+        line = sm->raw + sm->rawpos;
+        nl = memchr(line, '\n', sm->rawlen - sm->rawpos);
+        if ((nl == NULL) && sm->eof && (sm->rawpos < sm->rawlen)) {
+            nl = sm->raw + sm->rawlen;
+        }
+        if (nl != NULL) {
+            len = nl - line;
+            if (memchr(line, '\r', nl - line) != NULL) {
+                for (i = 0; i < nl - line; i++) {
+                    len -= (line[i] == '\r');
+                }
+            }
+            if (len >= MINSUBLEN) {
+                if (w->len + len + 1 > w->size) {
+                    if (w->len > 0) {
+                        break;
+                    }
+                    w->size = len + 1;
+                    w->data = realloc(w->data, w->size + DATAPAD);
+                    if (w->data == NULL) {
+                        printf("Unable to allocate a window for a line of %ld bytes\n", len);
+                        exit(1);
+                    }
+                }
+                if ((w->nruns == 0) || (w->runs[w->nruns - 1].ref != (uint32_t) sm->file)) {
+                    if (w->nruns == w->maxruns) {
+                        w->maxruns = (w->maxruns == 0) ? 64 : (2 * w->maxruns);
+                        w->runs = realloc(w->runs, w->maxruns * sizeof(struct provrun));
+                        if (w->runs == NULL) {
+                            printf("Unable to allocate the run table\n");
+                            exit(1);
+                        }
+                    }
+                    w->runs[w->nruns].offset = w->len;
+                    w->runs[w->nruns].ref = sm->file;
+                    w->runs[w->nruns].nref = 1;
+                    w->nruns++;
+                }
+                out = w->data + w->len;
+                if (len == nl - line) {
+                    memcpy(out, line, len);
+                }
+                else {
+                    for (i = 0; line + i < nl; i++) {
+                        if (line[i] != '\r') {
+                            *out++ = line[i];
+                        }
+                    }
+                    out = w->data + w->len;
+                }
+                // replace \n with null to make all lines strings
+                out[len] = (char) 0;
+                w->len += len + 1;
+                sm->outoff += len + 1;
+            }
+            sm->rawpos = (nl - sm->raw) + ((nl < sm->raw + sm->rawlen) ? 1 : 0);
+            continue;
         }
+
+        /* Move on to the next file when this one is used up */
+        if (sm->eof) {
+            close(sm->fd);
+            sm->fd = -1;
+            sm->eof = 0;
+            sm->file++;
+            sm->rawlen = 0;
+            sm->rawpos = 0;
+        }
+        if (sm->fd < 0) {
+            if (sm->file >= sm->nfiles) {
+                memset(w->data + w->len, 0, DATAPAD);
+                return(0);
+            }
+            name = sm->names + ((long) sm->file * MAXNAMELEN);
+            sm->fd = open(name, O_RDONLY);
+            if (sm->fd < 0) {
+                printf("Unable to open %.*s.  Exiting...\n", MAXNAMELEN, name);
+                exit(-1);
+            }
+            (void) posix_fadvise(sm->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+            sm->pos = 0;
+        }
+
+        /* Read more of the file after the part line we have */
+        memmove(sm->raw, sm->raw + sm->rawpos, sm->rawlen - sm->rawpos);
+        sm->rawlen -= sm->rawpos;
+        sm->rawpos = 0;
+        if (sm->rawlen == sm->rawsz) {
+            sm->rawsz *= 2;
+            sm->raw = realloc(sm->raw, sm->rawsz);
+            if (sm->raw == NULL) {
+                printf("Unable to allocate a read buffer of %ld bytes\n", sm->rawsz);
+                exit(1);
+            }
+        }
+        got = pread(sm->fd, sm->raw + sm->rawlen, sm->rawsz - sm->rawlen, sm->pos);
+        if (got < 0) {
+            printf("Error reading %.*s\n", MAXNAMELEN, sm->names + ((long) sm->file * MAXNAMELEN));
+            perror(NULL);
+            exit(-1);
+        }
+        if (got == 0) {
+            sm->eof = 1;
+        }
+        sm->pos += got;
+        sm->rawlen += got;
     }
-    return(-1);
+    memset(w->data + w->len, 0, DATAPAD);
+    return(1);
 }
 
 
+/*
+ * run_coordinator() : split a search between Nthread worker processes
+ * (-W), on this machine or others, that connect to us on TCP port
+ * Coordport.  Each worker has its own copy of /gutenberg, which must
+ * match the first worker's.  The workers get the targets as a daemon
+ * query (see read_query()) and then ask for ranges of chunks, a few
+ * at a time, until there are none left.  The matches they send are
+ * printed here.  When every target is found (unless -a) the workers
+ * are told to stop.  The range of a worker that goes away is handed
+ * to another, so with -a matches it had already sent from that range
+ * are printed again.
+ *
+ * The protocol is lines of text.  A worker sends
+ *    hello <datalen> <fingerprint> <threads> <hash>   once, on connecting
+ *    next <hashed>     for another range, when done with the last
+ *    match <target> <offset> <string in hex>
+ *    done <hashed>     when told there is no more
+ * and the coordinator sends the query, then
+ *    range <first chunk> <chunk after the last>   or   end
+ * in answer to each next, and stop at any time.
+ */
+void run_coordinator()
+{
+    int           lfd;         // the listening socket
+    struct sockaddr_in addr;   // its address
+    int           one;         // for setsockopt()
+    PEER         *peers;       // the workers
+    struct pollfd *pfd;        // their sockets, for poll()
+    int           npeer;       // how many have joined
+    int           nactive;     // how many are still connected
+    char          line[MAXMSG]; // a line from a worker
+    long          datalen;     // a worker's data set length
+    uint64_t      fp;          // and fingerprint
+    int           nthr;        // and number of threads
+    char          hname[16];   // and hash
+    uint64_t      fp0;         // the first worker's fingerprint
+    char         *query;       // the query to send to each worker
+    size_t        qlen;        // its length
+    int          *lost;        // ranges of workers that went away, two ints each
+    int           nlost;       // number of ranges in lost
+    int           next;        // next chunk to hand out
+    int           grain;       // chunks in a range
+    int           stopsent;    // the workers have been told to stop
+    int           tidx;        // target number of a match
+    long          offset;      // and its offset
+    char          hex[(2 * MAXSUBLEN) + 2]; // and its string in hex
+    char          str[MAXSUBLEN + 1]; // and the string
+    uint64_t      hashed;      // substrings hashed by all workers
+    uint64_t      t0;          // when the search started
+    uint64_t      tlast;       // time of the last progress report
+    uint64_t      t;           // time now
+    double        secs;        // length of the search
+    int           i, j;        // generic loop indexes
+    int           n;           // generic return value
+    unsigned int  c;           // a byte of the string
+
+    (void) signal(SIGPIPE, SIG_IGN);
+    peers = calloc(Nthread, sizeof(PEER));
+    pfd = calloc(Nthread, sizeof(struct pollfd));
+    lost = malloc(2 * Nthread * sizeof(int));
+    if ((peers == NULL) || (pfd == NULL) || (lost == NULL)) {
+        printf("Unable to allocate the worker table\n");
+        exit(1);
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(atoi(Coordport));
+    one = 1;
+    lfd = socket(AF_INET, SOCK_STREAM, 0);
+    if ((lfd < 0) || (setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0) ||
+        (bind(lfd, (struct sockaddr *) &addr, sizeof(addr)) < 0) || (listen(lfd, 64) < 0)) {
+        printf("Unable to listen on port %s\n", Coordport);
+        perror(NULL);
+        exit(1);
+    }
+
+    /* Wait for the workers.  They must all have the same data set. */
+    printf("Waiting for %d workers on port %s\n", Nthread, Coordport);
+    fflush(stdout);
+    fp0 = 0;
+    npeer = 0;
+    while (npeer < Nthread) {
+        peers[npeer].lb.fd = accept(lfd, NULL, NULL);
+        if (peers[npeer].lb.fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("accept");
+            exit(1);
+        }
+        (void) setsockopt(peers[npeer].lb.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        peers[npeer].lb.len = 0;
+        if ((read_line(&peers[npeer].lb, line) == 0) ||
+            (sscanf(line, "hello %ld %lx %d %15s", &datalen, &fp, &nthr, hname) != 4)) {
+            printf("A worker did not say hello, dropping it\n");
+            close(peers[npeer].lb.fd);
+            continue;
+        }
+        if (strcmp(hname, Hash->name) != 0) {
+            printf("A worker is searching %s sums, not %s, dropping it\n", hname, Hash->name);
+            close(peers[npeer].lb.fd);
+            continue;
+        }
+        if (npeer == 0) {
+            Datalen = datalen;
+            fp0 = fp;
+        }
+        else if ((datalen != Datalen) || (fp != fp0)) {
+            printf("A worker has a different /gutenberg, dropping it\n");
+            close(peers[npeer].lb.fd);
+            continue;
+        }
+        printf("Worker %d joined with %d threads\n", npeer, nthr);
+        fflush(stdout);
+        peers[npeer].active = 1;
+        npeer++;
+    }
+    close(lfd);
+
+    /* Cut the data set into chunks as each worker will, and send them
+     * the query */
+    load_prov();
+    start_chunks();
+    grain = Nchunks / (npeer * RANGESPLIT);
+    if (grain < 1) {
+        grain = 1;
+    }
+    Out = open_memstream(&query, &qlen);
+    fprintf(Out, "length %d\n", Sublen);
+    if (Allmatch) {
+        fprintf(Out, "all\n");
+    }
+    for (i = 0; i < Targets.count; i++) {
+        print_sum(&Targets.sums[i]);
+        fprintf(Out, "\n");
+    }
+    fprintf(Out, "\n");
+    fclose(Out);
+    Out = stdout;
+    for (i = 0; i < npeer; i++) {
+        write_all(peers[i].lb.fd, query, qlen);
+    }
+    free(query);
+
+    /* Hand out ranges and print matches until every worker is done */
+    t0 = now_ns();
+    tlast = t0;
+    next = 0;
+    nlost = 0;
+    stopsent = 0;
+    Stop = 0;
+    nactive = npeer;
+    while (nactive > 0) {
+        for (i = 0; i < npeer; i++) {
+            pfd[i].fd = peers[i].active ? peers[i].lb.fd : -1;
+            pfd[i].events = POLLIN;
+        }
+        n = poll(pfd, npeer, (Interval > 0) ? (int) (Interval * 1000) : -1);
+        if ((n < 0) && (errno != EINTR)) {
+            perror("poll");
+            exit(1);
+        }
+        t = now_ns();
+        if ((Interval > 0) && ((t - tlast) / 1e9 >= Interval)) {
+            hashed = 0;
+            for (i = 0; i < npeer; i++) {
+                hashed += peers[i].hashed;
+            }
+            fprintf(stderr, "%6.1fs %5.1f%% handed out, %d workers, %lu hashed\n",
+                    (t - t0) / 1e9, (Nchunks > 0) ? (100.0 * next / Nchunks) : 100.0,
+                    nactive, (unsigned long) hashed);
+            tlast = t;
+        }
+        for (i = 0; (n > 0) && (i < npeer); i++) {
+            if ((pfd[i].revents == 0) || !peers[i].active) {
+                continue;
+            }
+            j = read(peers[i].lb.fd, peers[i].lb.buf + peers[i].lb.len,
+                     MAXMSG - peers[i].lb.len);
+            if (j > 0) {
+                peers[i].lb.len += j;
+            }
+            else {
+                /* gone without saying done; its range goes to someone else */
+                printf("Worker %d went away\n", i);
+                if (peers[i].first < peers[i].last) {
+                    lost[2 * nlost] = peers[i].first;
+                    lost[(2 * nlost) + 1] = peers[i].last;
+                    nlost++;
+                }
+                close(peers[i].lb.fd);
+                peers[i].active = 0;
+                nactive--;
+                continue;
+            }
+            while (peers[i].active && take_line(&peers[i].lb, line)) {
+                if (sscanf(line, "next %lu", &peers[i].hashed) == 1) {
+                    peers[i].first = peers[i].last = 0;
+                    if (Stop || ((next >= Nchunks) && (nlost == 0))) {
+                        dprintf(peers[i].lb.fd, "end\n");
+                    }
+                    else {
+                        if (nlost > 0) {
+                            nlost--;
+                            peers[i].first = lost[2 * nlost];
+                            peers[i].last = lost[(2 * nlost) + 1];
+                        }
+                        else {
+                            peers[i].first = next;
+                            next = (next + grain < Nchunks) ? (next + grain) : Nchunks;
+                            peers[i].last = next;
+                        }
+                        dprintf(peers[i].lb.fd, "range %d %d\n", peers[i].first, peers[i].last);
+                    }
+                }
+                else if ((sscanf(line, "match %d %ld %239s", &tidx, &offset, hex) == 3) &&
+                         (tidx >= 0) && (tidx < Targets.count) &&
+                         (strlen(hex) == (size_t) (2 * Sublen))) {
+                    for (j = 0; j < Sublen; j++) {
+                        (void) sscanf(hex + (2 * j), "%2x", &c);
+                        str[j] = (char) c;
+                    }
+                    report_match(tidx, str, Sublen, offset);
+                }
+                else if (sscanf(line, "done %lu", &peers[i].hashed) == 1) {
+                    close(peers[i].lb.fd);
+                    peers[i].active = 0;
+                    nactive--;
+                }
+            }
+
+            /* tell everyone once the last target is found */
+            if (Stop && !stopsent) {
+                for (j = 0; j < npeer; j++) {
+                    if (peers[j].active) {
+                        dprintf(peers[j].lb.fd, "stop\n");
+                    }
+                }
+                stopsent = 1;
+            }
+        }
+    }
+    if ((nlost > 0) || ((next < Nchunks) && !Stop)) {
+        printf("The workers went away before the search was done\n");
+    }
+
+    hashed = 0;
+    for (i = 0; i < npeer; i++) {
+        hashed += peers[i].hashed;
+    }
+    secs = (now_ns() - t0) / 1e9;
+    fprintf(stderr, "Hashed %lu substrings in %.3fs with %d workers, %.1f Mhash/s\n",
+            (unsigned long) hashed, secs, npeer, hashed / secs / 1e6);
+    free(peers);
+    free(pfd);
+    free(lost);
+}
+
+
+/*
+ * run_worker() : search the ranges of chunks that the coordinator at
+ * Coordinator (host:port) hands us with the worker pool, and send it
+ * the matches (see run_coordinator()).  A stop from the coordinator
+ * is noticed while a range is being searched.
+ */
+void run_worker(struct vkernel *kern)
+{
+    char         *host;        // the coordinator's host
+    char         *port;        // and port
+    struct addrinfo hints;     // what sort of address we want
+    struct addrinfo *ai;       // the addresses of host
+    int           one;         // for setsockopt()
+    LINEBUF       lb;          // lines from the coordinator
+    char          line[MAXMSG]; // one of them
+    char         *query;       // the query, gathered up
+    size_t        qlen;        // its length
+    FILE         *qf;          // the query as a stream
+    FILE         *qin;         // it again, for read_query()
+    union targetsum *sums;     // the sums of the query
+    int           nsum;        // how many there are
+    int           len;         // substring length of the query
+    int           all;         // report every match
+    int           first, last; // a range of chunks
+    int           more;        // the coordinator has more ranges
+    uint64_t      hashed;      // substrings we have hashed
+    struct pollfd pfd;         // the coordinator's socket, for poll()
+    int           nrange;      // ranges searched
+    int           i;           // generic loop index
+
+    (void) signal(SIGPIPE, SIG_IGN);
+    host = strdup(Coordinator);
+    port = strrchr(host, ':');
+    if (port == NULL) {
+        printf("The coordinator must be given as host:port\n");
+        exit(1);
+    }
+    *port++ = (char) 0;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &ai) != 0) {
+        printf("Unable to find coordinator %s\n", Coordinator);
+        exit(1);
+    }
+    Coordfd = socket(AF_INET, SOCK_STREAM, 0);
+    if ((Coordfd < 0) || (connect(Coordfd, ai->ai_addr, ai->ai_addrlen) < 0)) {
+        printf("Unable to connect to coordinator %s\n", Coordinator);
+        perror(NULL);
+        exit(1);
+    }
+    freeaddrinfo(ai);
+    free(host);
+    one = 1;
+    (void) setsockopt(Coordfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    lb.fd = Coordfd;
+    lb.len = 0;
+    dprintf(Coordfd, "hello %d %lx %d %s\n", Datalen, (unsigned long) data_fingerprint(), Nthread,
+            Hash->name);
+
+    /* Read the query, which ends with a blank line */
+    qf = open_memstream(&query, &qlen);
+    do {
+        if (read_line(&lb, line) == 0) {
+            printf("The coordinator went away\n");
+            exit(1);
+        }
+        fprintf(qf, "%s\n", line);
+    } while (line[0] != (char) 0);
+    fclose(qf);
+    qin = fmemopen(query, qlen, "r");
+    if ((qin == NULL) || (read_query(qin, Sublen, &sums, &nsum, &len, &all) != QUERY_OK)) {
+        printf("Bad query from the coordinator\n");
+        exit(1);
+    }
+    fclose(qin);
+    free(query);
+    Sublen = len;
+    Vmd5 = kern->tab[Sublen];
+    Vmd5x = kern->gather;
+    Lanes = kernel_lanes(kern, Sublen);
+    Allmatch = all;
+    build_targets(sums, nsum);
+    printf("Working for %s on %d target %s sums of length %d\n", Coordinator, Targets.count,
+           Hash->label, Sublen);
+    fflush(stdout);
+
+    /* Search ranges until there are no more */
+    start_search();
+    start_threads(do_worker);
+    nrange = 0;
+    more = 1;
+    while (more && !Stop) {
+        hashed = 0;
+        for (i = 0; i < Nthread; i++) {
+            hashed += Slots[i].hashed;
+        }
+        pthread_mutex_lock(&Outlock);
+        dprintf(Coordfd, "next %lu\n", (unsigned long) hashed);
+        pthread_mutex_unlock(&Outlock);
+        more = 0;
+        for (;;) {
+            if (read_line(&lb, line) == 0) {
+                break;
+            }
+            if (strcmp(line, "stop") == 0) {
+                Stop = 1;
+            }
+            else if (sscanf(line, "range %d %d", &first, &last) == 2) {
+                more = 1;
+                break;
+            }
+            else if (strcmp(line, "end") == 0) {
+                break;
+            }
+        }
+        if (!more || Stop) {
+            break;
+        }
+
+        /* Search the range, watching for a stop */
+        Nextchunk = first;
+        Endchunk = (last < Nchunks) ? last : Nchunks;
+        Ndone = 0;
+        wake_pool();
+        pfd.fd = Coordfd;
+        pfd.events = POLLIN;
+        while (__atomic_load_n(&Ndone, __ATOMIC_ACQUIRE) < Nthread) {
+            if (poll(&pfd, 1, 10) > 0) {
+                i = read(Coordfd, lb.buf + lb.len, MAXMSG - lb.len);
+                if (i <= 0) {
+                    Stop = 1;       // the coordinator has gone
+                    pfd.fd = -1;
+                }
+                else {
+                    lb.len += i;
+                }
+                while (take_line(&lb, line)) {
+                    if (strcmp(line, "stop") == 0) {
+                        Stop = 1;
+                    }
+                }
+            }
+        }
+        wait_pool();
+        nrange++;
+    }
+    stop_pool();
+    end_search();
+
+    hashed = 0;
+    for (i = 0; i < Nthread; i++) {
+        hashed += Slots[i].hashed;
+    }
+    pthread_mutex_lock(&Outlock);
+    dprintf(Coordfd, "done %lu\n", (unsigned long) hashed);
+    pthread_mutex_unlock(&Outlock);
+    close(Coordfd);
+    printf("Searched %d ranges\n", nrange);
+    print_summary();
+    free_targets();
+}
+
+
+/*
+ * take_line() : if 'lb' holds a whole line, move it to 'line' without
+ * its newline and return 1, else return 0.  A line too long for the
+ * buffer is thrown away.
+ */
+int take_line(LINEBUF *lb, char *line)
+{
+    char         *nl;          // end of the line
+
+    nl = memchr(lb->buf, '\n', lb->len);
+    if (nl == NULL) {
+        if (lb->len == MAXMSG) {
+            lb->len = 0;
+        }
+        return(0);
+    }
+    memcpy(line, lb->buf, nl - lb->buf);
+    line[nl - lb->buf] = (char) 0;
+    lb->len -= (nl - lb->buf) + 1;
+    memmove(lb->buf, nl + 1, lb->len);
+    return(1);
+}
+
+
+/*
+ * read_line() : wait for the next line from 'lb' and move it to 'line'.
+ * Return 0 if the other end has gone.
+ */
+int read_line(LINEBUF *lb, char *line)
+{
+    int           n;           // bytes read
+
+    while (take_line(lb, line) == 0) {
+        n = read(lb->fd, lb->buf + lb->len, MAXMSG - lb->len);
+        if (n <= 0) {
+            if ((n < 0) && (errno == EINTR)) {
+                continue;
+            }
+            return(0);
+        }
+        lb->len += n;
+    }
+    return(1);
+}
+
+
+/*
+ * write_all() : write the 'len' bytes at 'buf' to 'fd'.
+ */
+void write_all(int fd, const char *buf, long len)
+{
+    long          n;           // bytes written
+
+    while (len > 0) {
+        n = write(fd, buf, len);
+        if (n <= 0) {
+            if ((n < 0) && (errno == EINTR)) {
+                continue;
+            }
+            return;
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+
+/*
+ * read_query() : read a query from 'in'.  A query is a set of lines
+ * ended by a blank line or the end of the input:
+ *    length <n>   substring length, 'deflen' if not given
+ *    all          report every match with its offset
+ *    shutdown     stop the daemon
+ * and any other line is a hex sum to look for ('#' starts a comment).
+ * On QUERY_OK *sums is a malloc()ed table of the *nsum sums.  Errors
+ * are written to Out.
+ */
+int read_query(FILE *in, int deflen, union targetsum **sums, int *nsum, int *len, int *all)
+{
+    char         line[MAXDIGLINE]; // one line of the query
+    char        *p;           // start of the text in line
+    int          nalloc;      // allocated size of *sums
+    int          nline;       // lines in the query so far
+    int          bad;         // number of bad lines
+    int          quit;        // shutdown was asked for
+
+    *nsum = 0;
+    *len = deflen;
+    *all = 0;
+    nline = 0;
+    bad = 0;
+    quit = 0;
+    nalloc = 64;
+    *sums = malloc(nalloc * sizeof(union targetsum));
+    if (*sums == NULL) {
+        printf("Unable to allocate target table\n");
+        exit(1);
+    }
+    while (fgets(line, MAXDIGLINE, in) != NULL) {
+        p = line + strspn(line, " \t");
+        p[strcspn(p, "\r\n#")] = (char) 0;
+        if (*p == (char) 0) {
+            if (nline == 0) {
+                continue;     // blank lines before the query
+            }
+            break;
+        }
+        nline++;
+        if (strncmp(p, "length", 6) == 0) {
+            if ((sscanf(p + 6, "%d", len) != 1) ||
+                (*len < MINSUBLEN) || (*len > MAXSUBLEN)) {
+                fprintf(Out, "error: the substring length must be between %d and %d\n",
+                        MINSUBLEN, MAXSUBLEN);
+                bad++;
+            }
+        }
+        else if (strcmp(p, "all") == 0) {
+            *all = 1;
+        }
+        else if (strcmp(p, "shutdown") == 0) {
+            quit = 1;
+        }
+        else {
+            if (*nsum == nalloc) {
+                nalloc *= 2;
+                *sums = realloc(*sums, nalloc * sizeof(union targetsum));
+                if (*sums == NULL) {
+                    printf("Unable to allocate target table\n");
+                    exit(1);
+                }
+            }
+            p[strcspn(p, " \t")] = (char) 0;
+            if (parse_sum(p, &(*sums)[*nsum]) != 0) {
+                fprintf(Out, "error: bad sum '%s'\n", p);
+                bad++;
+            }
+            else {
+                (*nsum)++;
+            }
+        }
+    }
+    if (quit) {
+        free(*sums);
+        return(QUERY_QUIT);
+    }
+    if ((nline == 0) || bad || (*nsum == 0)) {
+        if ((nline != 0) && (bad == 0)) {
+            fprintf(Out, "error: no sums given\n");
+        }
+        free(*sums);
+        return((nline == 0) ? QUERY_EOF : QUERY_BAD);
+    }
+    return(QUERY_OK);
+}
+
+
+/*
+ * parse_sum() : convert a hex string of 8 characters per word to a
+ * sum of the hash we are searching with.  Trailing characters after
+ * the hex digits are not allowed.  Return 0 on success and -1 (after
+ * printing why) on error.
+ */
+int parse_sum(const char *str, union targetsum *sum)
+{
+    int          i;           // generic loop counter
+    char         c;           // generic char varible
+    int          hex;         // hex digit in the input sum
+    int          nbytes;      // bytes in the sum
+
+    nbytes = 4 * Hash->nwords;
+    if ((2 * nbytes) != strnlen(str, (4 * MAXWORDS) + 100)) {
+        printf("Invalid target %s sum length\n", Hash->label);
+        return(-1);
+    }
+    for (i = 0; i < (2 * nbytes); i++) {
+        if (isxdigit(str[i]) == 0) {
+            printf("Invalid target %s sum character '%c'\n", Hash->label, str[i]);
+            return(-1);
+        }
+    }
+
+    /* Put the sum into an array */
+    memset(sum, 0, sizeof(*sum));
+    for (i = 0 ; i < nbytes; i++) {
+        c = tolower(str[(2 * i)]);
+        if (c <= '9')
+            hex = (int)(c - '0');
+        else
+            hex = 10 + (int)(c - 'a');
+        sum->c[i] = hex << 4;
+        c = tolower(str[(2 * i) + 1]);
+        if (c <= '9')
+            hex = (int)(c - '0');
+        else
+            hex = 10 + (int)(c - 'a');
+        sum->c[i] = sum->c[i] + hex;
+    }
+    if (Hash->bigendian) {
+        for (i = 0; i < Hash->nwords; i++) {
+            sum->i[i] = __builtin_bswap32(sum->i[i]);
+        }
+    }
+    return(0);
+}
+
+
+/*
+ * parse_mask() : read the -m pattern 'str' into the sum bits to match,
+ * 'val', and the mask of which bits those are, 'mask'.  It is either
+ * hex digits that the sum must start with, followed by /bits to
+ * compare just the first 'bits' bits of them, or two hex sums, the
+ * value and the mask, separated by ':'.  Digits missing from the end
+ * of either are taken as zeros.  Return -1 if it is not valid.
+ */
+int parse_mask(const char *str, union targetsum *val, union targetsum *mask)
+{
+    char         v[(8 * MAXWORDS) + 1]; // the value as a whole sum
+    char         m[(8 * MAXWORDS) + 1]; // and the mask
+    const char  *sep;         // the '/' or ':' in str, or its end
+    int          nhex;        // hex digits in a sum
+    int          vlen;        // hex digits of the value given
+    int          bits;        // leading bits to compare (/bits)
+    int          i;           // generic loop counter
+
+    nhex = 8 * Hash->nwords;
+    sep = str + strcspn(str, "/:");
+    vlen = sep - str;
+    if ((vlen == 0) || (vlen > nhex)) {
+        return(-1);
+    }
+    memset(v, '0', nhex);
+    memset(m, '0', nhex);
+    v[nhex] = (char) 0;
+    m[nhex] = (char) 0;
+    memcpy(v, str, vlen);
+    if (*sep == ':') {
+        i = strlen(sep + 1);
+        if ((i == 0) || (i > nhex)) {
+            return(-1);
+        }
+        memcpy(m, sep + 1, i);
+    }
+    else {
+        bits = 4 * vlen;
+        if ((*sep == '/') &&
+            ((sscanf(sep + 1, "%d", &bits) != 1) || (bits < 1) || (bits > 4 * vlen))) {
+            return(-1);
+        }
+        for (i = 0; i < bits / 4; i++) {
+            m[i] = 'f';
+        }
+        if ((bits % 4) != 0) {
+            m[i] = hexdigits[(0xf0 >> (bits % 4)) & 0xf];
+        }
+    }
+    if ((parse_sum(v, val) != 0) || (parse_sum(m, mask) != 0)) {
+        return(-1);
+    }
+    for (i = 0; i < MAXWORDS; i++) {
+        val->i[i] &= mask->i[i];
+    }
+    return(0);
+}
+
+
+/*
+ * print_sum() : print a sum as hex characters to Out
+ */
+void print_sum(union targetsum *sum)
+{
+    int          i;           // generic loop counter
+    uint8_t      c;           // byte of the sum
+
+    for (i = 0 ; i < 4 * Hash->nwords; i++) {
+        c = Hash->bigendian ? (uint8_t) (sum->i[i / 4] >> (24 - (8 * (i % 4)))) : sum->c[i];
+        fputc(hexdigits[c >> 4], Out);
+        fputc(hexdigits[c & 0xf], Out);
+    }
+}
+
+
+/*
+ * cmp_sum() : qsort() ordering of sums, by i[0] then i[1]...
+ */
+static int cmp_sum(const void *pa, const void *pb)
+{
+    const union targetsum *a = pa;
+    const union targetsum *b = pb;
+    int          i;
+
+    for (i = 0; i < Hash->nwords; i++) {
+        if (a->i[i] != b->i[i])
+            return((a->i[i] < b->i[i]) ? -1 : 1);
+    }
+    return(0);
+}
+
+
+/*
+ * load_targets() : build the global target set from the sums in the
+ * file 'fname' (one hex sum per line, '#' starts a comment) plus the
+ * optional single sum 'extra'.  Either may be NULL.
+ */
+void load_targets(const char *fname, union targetsum *extra)
+{
+    FILE        *fp;          // the digest file
+    char         line[MAXDIGLINE]; // one line of the digest file
+    char        *p;           // start of the sum in line
+    int          lineno;      // line number for error messages
+    int          n;           // number of sums read
+    int          nalloc;      // allocated size of Targets.sums
+
+    n = 0;
+    nalloc = 1024;
+    Targets.sums = malloc(nalloc * sizeof(union targetsum));
+    if (Targets.sums == NULL) {
+        printf("Unable to allocate target table\n");
+        exit(1);
+    }
+    if (extra != NULL) {
+        Targets.sums[n++] = *extra;
+    }
+
+    if (fname != NULL) {
+        fp = fopen(fname, "r");
+        if (fp == NULL) {
+            printf("Unable to open digest file %s\n", fname);
+            perror(NULL);
+            exit(1);
+        }
+        lineno = 0;
+        while (fgets(line, MAXDIGLINE, fp) != NULL) {
+            lineno++;
+            p = line + strspn(line, " \t");
+            p[strcspn(p, " \t\r\n#")] = (char) 0;
+            if (*p == (char) 0) {
+                continue;     // blank line or comment
+            }
+            if (n == nalloc) {
+                nalloc *= 2;
+                Targets.sums = realloc(Targets.sums, nalloc * sizeof(union targetsum));
+                if (Targets.sums == NULL) {
+                    printf("Unable to allocate target table\n");
+                    exit(1);
+                }
+            }
+            if (parse_sum(p, &Targets.sums[n]) != 0) {
+                printf("Bad sum on line %d of %s\n", lineno, fname);
+                exit(1);
+            }
+            n++;
+        }
+        fclose(fp);
+    }
+    if (n == 0) {
+        printf("No target %s sums given\n", Hash->label);
+        exit(1);
+    }
+    build_targets(Targets.sums, n);
+}
+
+
+/*
+ * build_targets() : make the 'n' sums at 'sums', which must come from
+ * malloc(), the global target set.  Duplicate sums are removed and
+ * the prefilter bitmap sized to keep false positives to a few percent
+ * while staying small enough to live in cache.
+ */
+void build_targets(union targetsum *sums, int n)
+{
+    int          bits;        // log2 of the bitmap size
+    int          i, j;        // generic loop index
+    uint32_t     key;         // bitmap index of a sum
+
+    /* sort and remove duplicates */
+    Targets.sums = sums;
+    qsort(Targets.sums, n, sizeof(union targetsum), cmp_sum);
+    for (i = 1, j = 0; i < n; i++) {
+        if (cmp_sum(&Targets.sums[i], &Targets.sums[j]) != 0) {
+            Targets.sums[++j] = Targets.sums[i];
+        }
+    }
+    Targets.count = j + 1;
+    Targets.found = 0;
+    Targets.done = calloc(Targets.count, 1);
+
+    /* 16 bitmap bits per target gives about a 6% false positive rate */
+    for (bits = MINTBITS; (bits < MAXTBITS) && ((1 << bits) < 16 * Targets.count); bits++)
+        ;
+    Targets.bmask = (1u << bits) - 1;
+    Targets.bitmap = calloc((1u << bits) / 64, sizeof(uint64_t));
+    if ((Targets.done == NULL) || (Targets.bitmap == NULL)) {
+        printf("Unable to allocate target table\n");
+        exit(1);
+    }
+    for (i = 0; i < Targets.count; i++) {
+        key = Targets.sums[i].i[0] & Targets.bmask;
+        Targets.bitmap[key >> 6] |= (uint64_t) 1 << (key & 63);
+    }
+}
+
+
+/*
+ * free_targets() : free the global target set.
+ */
+void free_targets()
+{
+    free(Targets.sums);
+    free(Targets.done);
+    free(Targets.bitmap);
+    memset(&Targets, 0, sizeof(Targets));
+}
+
+
+/*
+ * probe_target() : look up sum i of the 'lanes' sums in H, laid out
+ * as the kernels return them, in the target set.  Return the index
+ * of the target in Targets.sums or -1 if it is not one of the
+ * targets.  In a prefix search (-m) the kernel compared only the A
+ * word, so the masked bits of every word are checked here.
+ */
+static inline int probe_target(const uint32_t H[], int i, int lanes)
+{
+    union targetsum key;      // the sum to find
+    uint32_t     a;           // its first word
+    int          lo, hi, mid; // binary search bounds
+    int          cmp;         // result of compare
+    int          w;           // word index
+
+    if (Targets.mask != NULL) {
+        for (w = 0; w < Hash->nwords; w++) {
+            if ((H[(w * lanes) + i] & Targets.mask->i[w]) != Targets.sums[0].i[w]) {
+                return(-1);
+            }
+        }
+        return(0);
+    }
+    a = H[i];
+    if (((Targets.bitmap[(a & Targets.bmask) >> 6] >> (a & 63)) & 1) == 0) {
+        return(-1);
+    }
+    for (w = 0; w < Hash->nwords; w++) {
+        key.i[w] = H[(w * lanes) + i];
+    }
+    lo = 0;
+    hi = Targets.count - 1;
+    while (lo <= hi) {
+        mid = (lo + hi) / 2;
+        cmp = cmp_sum(&key, &Targets.sums[mid]);
+        if (cmp == 0)
+            return(mid);
+        if (cmp < 0)
+            hi = mid - 1;
+        else
+            lo = mid + 1;
+    }
+    return(-1);
+}
+
+
+/*
+ * report_match() : print the 'len' character string 'str', at offset
+ * 'offset' in the data set, that matches target number 'tidx', and the
+ * files it came from, to Out.  Each target is reported once, or every time with -a.
+ * The offset is printed with -a and in daemon mode.  A worker (-W)
+ * sends the match to its coordinator instead.  Tell the threads to
+ * stop when every target has been found (unless -a).
+ */
+void report_match(int tidx, const char *str, int len, long offset)
+{
+    int          i;           // generic loop index
+    char         hex[(2 * MAXSUBLEN) + 1]; // str in hex, for the coordinator
+
+    pthread_mutex_lock(&Outlock);
+    if ((Targets.done[tidx] == 0) || Allmatch) {
+        if (Targets.done[tidx] == 0) {
+            Targets.done[tidx] = 1;
+            Targets.found++;
+        }
+        Nmatch++;
+        if (Coordinator != NULL) {
+            /* a worker sends the match to the coordinator to print */
+            for (i = 0; i < len; i++) {
+                hex[2 * i] = hexdigits[(uint8_t) str[i] >> 4];
+                hex[(2 * i) + 1] = hexdigits[str[i] & 0xf];
+            }
+            hex[2 * len] = (char) 0;
+            dprintf(Coordfd, "match %d %ld %s\n", tidx, offset, hex);
+        }
+        else {
+            if (Targets.count > 1) {
+                print_sum(&Targets.sums[tidx]);
+                fprintf(Out, " ");
+            }
+            fprintf(Out, "Match with string '");
+            for (i = 0; i < len; i++)
+                fputc(str[i], Out);
+            if (Allmatch || (Daemon != NULL)) {
+                fprintf(Out, "' at offset %ld\n", Baseoff + offset);
+            }
+            else {
+                fprintf(Out, "'\n");
+            }
+            print_prov(offset);
+        }
+        if ((Targets.found == Targets.count) && (Allmatch == 0)) {
+            __atomic_store_n(&Stop, 1, __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(&Outlock);
+}
+
+
+/*
+ * report_hit() : add a prefix search (-m) hit, sum i of the 'lanes'
+ * sums in H and the 'len' character string 'str' at 'offset' in the
+ * data set, to this thread's buffer.  The sum is printed in full and
+ * the files are not.  A nearly full buffer is written out first.
+ */
+void report_hit(const uint32_t H[], int i, int lanes, const char *str, int len, long offset)
+{
+    HITBUF       *hb;          // this thread's hits
+    char         *p;           // where this one goes in hb->buf
+    uint32_t      word;        // a word of the sum
+    uint8_t       c;           // and a byte of it
+    int           w, j;        // generic loop index
+
+    hb = Myhits;
+    if (hb->len > HITBUFSZ - HITLINE) {
+        flush_hits(hb);
+    }
+    p = hb->buf + hb->len;
+    for (w = 0; w < Hash->nwords; w++) {
+        word = H[(w * lanes) + i];
+        for (j = 0; j < 4; j++) {
+            c = (uint8_t) (Hash->bigendian ? (word >> (24 - (8 * j))) : (word >> (8 * j)));
+            *p++ = hexdigits[c >> 4];
+            *p++ = hexdigits[c & 0xf];
+        }
+    }
+    p += sprintf(p, " Match with string '%.*s' at offset %ld\n", len, str, Baseoff + offset);
+    hb->len = p - hb->buf;
+    hb->nhit++;
+}
+
+
+/*
+ * flush_hits() : write the hits in 'hb' to Out and empty it.
+ */
+void flush_hits(HITBUF *hb)
+{
+    if (hb->len == 0) {
+        return;
+    }
+    pthread_mutex_lock(&Outlock);
+    fwrite(hb->buf, 1, hb->len, Out);
+    Nmatch += hb->nhit;
+    Targets.found = 1;
+    pthread_mutex_unlock(&Outlock);
+    hb->len = 0;
+    hb->nhit = 0;
+}
+
+
+
+/*
+ * load_prov() : map PROVSHM, which says which files the data set came
+ * from.  Matches are reported without their files if it is missing or
+ * does not describe the data set we have.
+ */
+void load_prov()
+{
+    int           fd;          // the segment
+    struct stat   st;          // its size
+    struct provhdr *hdr;       // and its header
+
+    fd = shm_open(PROVSHM, O_RDONLY, 0666);
+    if (fd < 0) {
+        return;
+    }
+    if ((fstat(fd, &st) < 0) || (st.st_size < (long) sizeof(struct provhdr))) {
+        close(fd);
+        return;
+    }
+    hdr = mmap((void *) 0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (hdr == MAP_FAILED) {
+        return;
+    }
+    if ((hdr->magic != PROVMAGIC) || (hdr->datalen != (uint64_t) Datalen) ||
+        (st.st_size != (long) (sizeof(struct provhdr) +
+                               ((uint64_t) hdr->nfiles * MAXNAMELEN) +
+                               (hdr->nruns * sizeof(struct provrun)) +
+                               (hdr->nrefs * sizeof(uint32_t))))) {
+        printf("Ignoring %s, it does not match /gutenberg\n", PROVSHM);
+        munmap(hdr, st.st_size);
+        return;
+    }
+    Prov = hdr;
+    Provlen = st.st_size;
+    Provnames = (char *) (hdr + 1);
+    Provruns = (struct provrun *) (Provnames + ((long) hdr->nfiles * MAXNAMELEN));
+    Provrefs = (uint32_t *) (Provruns + hdr->nruns);
+}
+
+
+/*
+ * load_lines() : map LINESHM, the index of the lines in the data set.
+ * The threads look for the nulls instead if it is missing or does not
+ * describe the data set we have.
+ */
+void load_lines()
+{
+    int           fd;          // the segment
+    struct stat   st;          // its size
+    struct lineshdr *hdr;      // and its header
+
+    fd = shm_open(LINESHM, O_RDONLY, 0666);
+    if (fd < 0) {
+        return;
+    }
+    if ((fstat(fd, &st) < 0) || (st.st_size < (long) sizeof(struct lineshdr))) {
+        close(fd);
+        return;
+    }
+    hdr = mmap((void *) 0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (hdr == MAP_FAILED) {
+        return;
+    }
+    if ((hdr->magic != LINESMAGIC) || (hdr->datalen != (uint64_t) Datalen) ||
+        (st.st_size != (long) (sizeof(struct lineshdr) +
+                               (hdr->nlines * sizeof(struct lineent))))) {
+        printf("Ignoring %s, it does not match /gutenberg\n", LINESHM);
+        munmap(hdr, st.st_size);
+        return;
+    }
+    if (hdr->minlen > (uint32_t) Sublen) {
+        printf("/gutenberg only has the lines of %u characters or more, reload it for length %d\n",
+               hdr->minlen, Sublen);
+    }
+    Lineshdr = hdr;
+    Lineslen = st.st_size;
+    Lines = (struct lineent *) (hdr + 1);
+    Nlines = hdr->nlines;
+}
+
+
+/*
+ * load_soa() : map SOASHM, the interleaved copy of the data set, for
+ * -S.  The threads scan the data set itself, with a warning, if it is
+ * missing or does not describe the data set we have.
+ */
+void load_soa()
+{
+    int           fd;          // the segment
+    struct stat   st;          // its size
+    struct soahdr *hdr;        // and its header
+
+    fd = shm_open(SOASHM, O_RDONLY, 0666);
+    if (fd < 0) {
+        printf("There is no %s (see shm_init -s), searching /gutenberg\n", SOASHM);
+        return;
+    }
+    if ((fstat(fd, &st) < 0) || (st.st_size < (long) sizeof(struct soahdr))) {
+        close(fd);
+        return;
+    }
+    hdr = mmap((void *) 0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (hdr == MAP_FAILED) {
+        return;
+    }
+    if ((hdr->magic != SOAMAGIC) || (hdr->datalen != (uint64_t) Datalen) ||
+        (hdr->nstreams != SOASTREAMS) || (hdr->step % 64 != 0) ||
+        (hdr->step * SOASTREAMS < hdr->datalen) ||
+        (hdr->nrows != (hdr->step + SOAPAD) / 4) ||
+        (st.st_size != (long) (sizeof(struct soahdr) +
+                               (hdr->nrows * SOASTREAMS * sizeof(uint32_t))))) {
+        printf("Ignoring %s, it does not match /gutenberg\n", SOASHM);
+        munmap(hdr, st.st_size);
+        return;
+    }
+    (void) madvise(hdr, st.st_size, MADV_HUGEPAGE);
+    Soa = hdr;
+    Soalen = st.st_size;
+    Soarows = (const uint32_t *) (hdr + 1);
+}
+
+
+/*
+ * print_prov() : list the files that the data set at 'offset' came
+ * from, up to PROVSHOW of them.
+ */
+void print_prov(long offset)
+{
+    long          lo, hi, mid; // binary search bounds in Provruns
+    struct provrun *run;       // the run holding offset
+    uint32_t      i;           // generic loop index
+
+    if ((Prov == NULL) || (Prov->nruns == 0)) {
+        return;
+    }
+    /* find the last run that starts at or before offset */
+    lo = 0;
+    hi = Prov->nruns - 1;
+    while (lo < hi) {
+        mid = (lo + hi + 1) / 2;
+        if (Provruns[mid].offset <= (uint64_t) offset) {
+            lo = mid;
+        }
+        else {
+            hi = mid - 1;
+        }
+    }
+    run = &Provruns[lo];
+    for (i = 0; (i < run->nref) && (i < PROVSHOW); i++) {
+        fprintf(Out, "    in %.*s\n", MAXNAMELEN, Provnames + ((long) Provrefs[run->ref + i] * MAXNAMELEN));
+    }
+    if (run->nref > PROVSHOW) {
+        fprintf(Out, "    and %u more files\n", run->nref - PROVSHOW);
+    }
+}
+
+
+/*
+ * data_fingerprint() : a quick fingerprint of the data set, from its
+ * length and 64 bytes every FPSTEP bytes and at the end, so an index
+ * built from a different /gutenberg is noticed.
+ */
+uint64_t data_fingerprint()
+{
+    uint64_t      h;           // FNV-1a hash so far
+    long          pos;         // start of a sample
+    long          i;           // generic loop index
+
+    h = 0xcbf29ce484222325ULL ^ (uint64_t) Datalen;
+    for (pos = 0; pos < Datalen; pos += FPSTEP) {
+        for (i = pos; (i < pos + 64) && (i < Datalen); i++) {
+            h = (h ^ (uint8_t) Dataset[i]) * 0x100000001b3ULL;
+        }
+    }
+    for (i = (Datalen > 64) ? Datalen - 64 : 0; i < Datalen; i++) {
+        h = (h ^ (uint8_t) Dataset[i]) * 0x100000001b3ULL;
+    }
+    return(h);
+}
+
+
+/*
+ * build_index() : hash every Sublen character substring of the data
+ * set and write their A words and offsets to the digest index file
+ * 'fname'.  The threads run the usual search with a prefilter that
+ * passes every lane, and each chunk's entries go to a slot of Ixtmp
+ * sized for it beforehand, so the threads never share a cursor.  The
+ * entries are then dealt out to their buckets in the file.
+ */
+void build_index(const char *fname)
+{
+    uint64_t      allbits;     // prefilter bitmap that passes every lane
+    long          n;           // substrings in the data set
+    long          s, e;        // first and last substring start in a line
+    long          cend;        // last of those in s's chunk
+    const char   *p;           // start of a line
+    const char   *nul;         // its end
+    int           c;           // chunk number
+    uint32_t      bbits;       // log2 of the number of buckets
+    uint32_t      nbucket;     // number of buckets
+    uint32_t     *fill;        // next free entry of each bucket
+    long          size;        // size of the index file
+    int           fd;          // the index file
+    struct idxhdr *hdr;        // it, mapped
+    uint32_t     *tab;         // its bucket table
+    struct idxent *ent;        // and entries
+    long          i;           // generic loop index
+
+    start_search();
+
+    /* Count the substrings starting in each chunk, which places each
+     * chunk's entries in Ixtmp */
+    Ixchunk = calloc(Nchunks + 1, sizeof(long));
+    if (Ixchunk == NULL) {
+        printf("Unable to allocate chunk table\n");
+        exit(1);
+    }
+    for (p = Dataset; p < Dataset + Datalen; p = nul + 1) {
+        nul = memchr(p, 0, Dataset + Datalen - p);
+        if (nul == NULL) {
+            nul = Dataset + Datalen;
+        }
+        s = p - Dataset;
+        e = (nul - Dataset) - Sublen;
+        while (s <= e) {
+            c = s / Chunksz;
+            cend = ((long) (c + 1) * Chunksz) - 1;
+            if (cend > e) {
+                cend = e;
+            }
+            Ixchunk[c + 1] += cend - s + 1;
+            s = cend + 1;
+        }
+    }
+    for (c = 0; c < Nchunks; c++) {
+        Ixchunk[c + 1] += Ixchunk[c];
+    }
+    n = Ixchunk[Nchunks];
+    Ixtmp = mmap((void *) 0, (n + 1) * sizeof(struct idxent), PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (Ixtmp == MAP_FAILED) {
+        printf("Unable to allocate %ld index entries\n", n);
+        perror(NULL);
+        exit(1);
+    }
+
+    /* A bitmap with every bit set passes every lane */
+    allbits = ~0ULL;
+    memset(&Targets, 0, sizeof(Targets));
+    Targets.count = 2;
+    Targets.bitmap = &allbits;
+    Targets.bmask = 0;
+    run_search();
+    print_summary();
+
+    /* Lay out the file */
+    for (bbits = 1; (bbits < 31) && (((uint64_t) IDXBUCKET << bbits) < (uint64_t) n); bbits++) {
+        ;
+    }
+    nbucket = (uint32_t) 1 << bbits;
+    size = sizeof(struct idxhdr) + ((long) (nbucket + 1) * sizeof(uint32_t)) +
+           (n * sizeof(struct idxent));
+    fd = open(fname, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if ((fd < 0) || (ftruncate(fd, size) < 0)) {
+        printf("Unable to create index file %s\n", fname);
+        perror(NULL);
+        exit(1);
+    }
+    hdr = mmap((void *) 0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (hdr == MAP_FAILED) {
+        printf("Unable to mmap index file %s\n", fname);
+        perror(NULL);
+        exit(1);
+    }
+    tab = (uint32_t *) (hdr + 1);
+    ent = (struct idxent *) (tab + nbucket + 1);
+
+    /* Count the entries in each bucket, turn the counts into starts
+     * and deal the entries out */
+    fill = malloc(nbucket * sizeof(uint32_t));
+    if (fill == NULL) {
+        printf("Unable to allocate bucket table\n");
+        exit(1);
+    }
+    for (i = 0; i < n; i++) {
+        tab[(Ixtmp[i].word >> (32 - bbits)) + 1]++;
+    }
+    for (i = 0; i < nbucket; i++) {
+        tab[i + 1] += tab[i];
+        fill[i] = tab[i];
+    }
+    for (i = 0; i < n; i++) {
+        ent[fill[Ixtmp[i].word >> (32 - bbits)]++] = Ixtmp[i];
+    }
+
+    hdr->sublen = Sublen;
+    hdr->datalen = Datalen;
+    hdr->datasum = data_fingerprint();
+    hdr->count = n;
+    hdr->bbits = bbits;
+    hdr->hash = Hash - Hashes;
+    hdr->magic = IDXMAGIC;
+    munmap(hdr, size);
+    if (close(fd) < 0) {
+        printf("Error writing index file %s\n", fname);
+        perror(NULL);
+        exit(1);
+    }
+    printf("Indexed %ld substrings of length %d in %s, %ld MB\n", n, Sublen, fname,
+           size / (1024 * 1024));
+    free(fill);
+    munmap(Ixtmp, (n + 1) * sizeof(struct idxent));
+    Ixtmp = NULL;
+    free(Ixchunk);
+}
+
+
+/*
+ * load_index() : map the digest index file 'fname'.  The index is not
+ * used if it is damaged or was built from a different data set.
+ */
+void load_index(const char *fname)
+{
+    int           fd;          // the index file
+    struct stat   st;          // its size
+    struct idxhdr *hdr;        // and its header
+
+    fd = open(fname, O_RDONLY);
+    if ((fd < 0) || (fstat(fd, &st) < 0)) {
+        printf("Unable to open index file %s, searching instead\n", fname);
+        return;
+    }
+    if (st.st_size < (long) sizeof(struct idxhdr)) {
+        printf("Ignoring index file %s, it is too short\n", fname);
+        close(fd);
+        return;
+    }
+    hdr = mmap((void *) 0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (hdr == MAP_FAILED) {
+        printf("Unable to mmap index file %s\n", fname);
+        return;
+    }
+    if ((hdr->magic != IDXMAGIC) || (hdr->bbits < 1) || (hdr->bbits > 31) ||
+        (st.st_size != (long) (sizeof(struct idxhdr) +
+                               ((((uint64_t) 1 << hdr->bbits) + 1) * sizeof(uint32_t)) +
+                               (hdr->count * sizeof(struct idxent))))) {
+        printf("Ignoring index file %s, it is damaged\n", fname);
+        munmap(hdr, st.st_size);
+        return;
+    }
+    if ((hdr->datalen != (uint64_t) Datalen) || (hdr->datasum != data_fingerprint())) {
+        printf("Ignoring index file %s, it does not match /gutenberg\n", fname);
+        munmap(hdr, st.st_size);
+        return;
+    }
+    if (hdr->hash != (uint32_t) (Hash - Hashes)) {
+        printf("Ignoring index file %s, it does not hold %s sums\n", fname, Hash->label);
+        munmap(hdr, st.st_size);
+        return;
+    }
+    Index = hdr;
+    Indexlen = st.st_size;
+    Ixbucket = (uint32_t *) (hdr + 1);
+    Ixent = (struct idxent *) (Ixbucket + ((uint32_t) 1 << hdr->bbits) + 1);
+}
+
+
+/*
+ * lookup_index() : find the targets in the digest index instead of
+ * searching.  Each entry in a target's bucket with its A word is
+ * confirmed by hashing the substring it points at, and reported like
+ * a match from a search.
+ */
+void lookup_index()
+{
+    int           t;           // index into Targets.sums
+    uint32_t      a;           // its A word
+    uint32_t      b;           // its bucket
+    uint32_t      j;           // entry in the bucket
+    uint32_t      sum[MAXWORDS]; // sum of the entry's substring
+    long          nprobe;      // substrings rehashed
+    uint64_t      t0;          // when we started
+
+    t0 = now_ns();
+    nprobe = 0;
+    for (t = 0; t < Targets.count; t++) {
+        a = Targets.sums[t].i[0];
+        b = a >> (32 - Index->bbits);
+        for (j = Ixbucket[b]; j < Ixbucket[b + 1]; j++) {
+            if (Ixent[j].word != a) {
+                continue;
+            }
+            nprobe++;
+            Hash->ref(Dataset + Ixent[j].offset, Sublen, sum);
+            if (memcmp(sum, Targets.sums[t].i, 4 * Hash->nwords) == 0) {
+                report_match(t, Dataset + Ixent[j].offset, Sublen, Ixent[j].offset);
+                if (!Allmatch) {
+                    break;
+                }
+            }
+        }
+    }
+    fprintf(stderr, "Looked up %d sums in the index, %ld substrings rehashed, in %.3f ms\n",
+            Targets.count, nprobe, (now_ns() - t0) / 1e6);
+}
+
+
+/*
+ * do_worker() : a thread of the daemon's worker pool.  Wait for each
+ * query and search for it like do_vshm(), until told to quit.
+ */
+void *do_worker(void *pthrd)
+{
+    int           gen;         // the last query we did
+
+    gen = 0;
+    for (;;) {
+        pthread_mutex_lock(&Poollock);
+        while (Generation == gen) {
+            pthread_cond_wait(&Poolwake, &Poollock);
+        }
+        gen = Generation;
+        pthread_mutex_unlock(&Poollock);
+        if (Quit) {
+            break;
+        }
+        (void) do_vshm(pthrd);
+        pthread_mutex_lock(&Poollock);
+        pthread_cond_signal(&Pooldone);
+        pthread_mutex_unlock(&Poollock);
+    }
+    return(NULL);
+}
+
+
+/*
+ * do_vshm() : search for the target md5 sums.  Take chunks of the
+ * data set until there are none left or we are told to stop.  When
+ * sweeping a range of lengths each chunk is searched for all of them
+ * in turn, while it is still in the cache.
+ */
+void *do_vshm(void *pthrd)
+{
+    THRDINFO     *me;          // our entry in Thrds
+    int           chunk;       // the chunk we are working on
+    uint32_t      H[MAXWORDS * MAXLANES]; // sums, one per lane
+    uint64_t      tsc;         // time stamp counter at the chunk start
+    int           len;         // substring length being searched
+    int           maxlen;      // and the longest one
+    vmd5fn        vmd5;        // the kernel for len
+    int           lanes;       // and the number of sums it computes
+
+    me = (THRDINFO *) pthrd;
+    maxlen = (Sweepmax > 0) ? Sweepmax : Sublen;
+    if ((Targets.mask != NULL) && (me->hits == NULL)) {
+        me->hits = calloc(1, sizeof(HITBUF));
+        if (me->hits == NULL) {
+            printf("Unable to allocate a buffer for matches\n");
+            exit(1);
+        }
+    }
+    Myhits = me->hits;
+    while (__atomic_load_n(&Stop, __ATOMIC_RELAXED) == 0) {
+        chunk = __atomic_fetch_add(&Nextchunk, 1, __ATOMIC_RELAXED);
+        if (chunk >= Endchunk) {
+            break;
+        }
+        if (Ixtmp != NULL) {
+            Ixnext = Ixtmp + Ixchunk[chunk];
+        }
+        tsc = __rdtsc();
+        for (len = Sublen; len <= maxlen; len++) {
+            if (Vsoa != NULL) {
+                scan_soa(chunk, me->data, H, me->stats);
+                continue;
+            }
+            if (Sweepmax == 0) {
+                vmd5 = Vmd5;
+                lanes = Lanes;
+            }
+            else {
+                vmd5 = Sweepfn[len];
+                lanes = Sweeplanes[len];
+            }
+            if (Lines != NULL) {
+                scan_lines(chunk, me->data, len, vmd5, lanes, H, me->stats);
+            }
+            else {
+                scan_chunk(chunk, me->data, len, vmd5, lanes, H, me->stats);
+            }
+        }
+        __atomic_store_n(&me->stats->cycles, me->stats->cycles + (__rdtsc() - tsc),
+                         __ATOMIC_RELAXED);
+        __atomic_store_n(&me->stats->chunks, me->stats->chunks + 1, __ATOMIC_RELAXED);
+    }
+    if (Myhits != NULL) {
+        flush_hits(Myhits);
+    }
+    __atomic_fetch_add(&Ndone, 1, __ATOMIC_RELEASE);
+    return(NULL);
+}
+
+
+/*
+ * nul_mask() : return a mask with bit i set if p[i] is a null, for
+ * the 64 bytes at p.
+ */
+static inline uint64_t nul_mask(const char *p)
+{
+    const __m128i zero = _mm_setzero_si128();
+    uint64_t      mask;        // the nulls found so far
+    int           i;           // generic loop index
+
+    mask = 0;
+    for (i = 0; i < 4; i++) {
+        mask |= (uint64_t) (uint16_t) _mm_movemask_epi8(
+                    _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (p + (16 * i))), zero))
+                << (16 * i);
+    }
+    return(mask);
+}
+
+
+/*
+ * check_lanes() : confirm the lanes in 'lmask' whose sums in H passed
+ * the kernel's check.  Lane i is the 'sublen' character substring at
+ * mydata[first + i], or at mydata[off[i]] if off is not NULL; 'data'
+ * is the start of the copy of the data set that mydata is in, and
+ * H holds 'lanes' sums.  While an index is being
+ * built every lane passes, and its A word and offset are stored at
+ * Ixnext instead.
+ */
+static inline void check_lanes(uint32_t lmask, const uint32_t H[], const char *data,
+                               const char *mydata, int first, const int32_t off[],
+                               int lanes, int sublen)
+{
+    int           i;           // lane number
+    int           cinx;        // offset of lane i's substring in mydata
+    int           match;       // index of a matching target
+
+    while (lmask != 0) {
+        i = __builtin_ctz(lmask);
+        lmask &= lmask - 1;
+        cinx = (off == NULL) ? (first + i) : off[i];
+        if (Ixtmp != NULL) {
+            Ixnext->word = H[i];
+            Ixnext->offset = (mydata - data) + cinx;
+            Ixnext++;
+            continue;
+        }
+        match = probe_target(H, i, lanes);
+        if ((match >= 0) && (Targets.mask != NULL)) {
+            report_hit(H, i, lanes, mydata + cinx, sublen, (mydata - data) + cinx);
+        }
+        else if (match >= 0) {
+            report_match(match, mydata + cinx, sublen, (mydata - data) + cinx);
+        }
+    }
+}
+
+
+/*
+ * hash_run() : hash the substrings starting at mydata[first] through
+ * mydata[last], which lie within one line.  Each whole call's worth
+ * goes to 'vmd5', which loads all of its lanes at once, and the rest
+ * are added to the 'nq' entries of 'queue', which go to the gather
+ * kernel 'vmd5x' whenever they fill its lanes.  Return the number of
+ * entries left in the queue.
+ */
+static inline int hash_run(const char *data, const char *mydata, int first, int last,
+                           int32_t queue[], int nq, vmd5fn vmd5, vmd5xfn vmd5x,
+                           int lanes, int sublen, uint32_t H[])
+{
+    int           cinx;        // start of the next substring
+    uint32_t      lmask;       // lanes that may hold a match
+
+    for (cinx = first; cinx + lanes - 1 <= last; cinx += lanes) {
+        lmask = vmd5(mydata + cinx, H, &Targets);
+        if (lmask != 0) {
+            check_lanes(lmask, H, data, mydata, cinx, NULL, lanes, sublen);
+        }
+    }
+    for ( ; cinx <= last; cinx++) {
+        queue[nq++] = cinx;
+        if (nq == lanes) {
+            lmask = vmd5x(mydata, queue, H, &Targets, sublen);
+            if (lmask != 0) {
+                check_lanes(lmask, H, data, mydata, 0, queue, lanes, sublen);
+            }
+            nq = 0;
+        }
+    }
+    return(nq);
+}
+
+
+/*
+ * flush_queue() : hash the 'nq' substrings left in 'queue', repeating
+ * the last entry to fill the lanes.
+ */
+static inline void flush_queue(const char *data, const char *mydata, int32_t queue[], int nq,
+                               vmd5xfn vmd5x, int lanes, int sublen, uint32_t H[])
+{
+    int           i;           // generic loop index
+    uint32_t      lmask;       // lanes that may hold a match
+
+    if (nq == 0) {
+        return;
+    }
+    for (i = nq; i < lanes; i++) {
+        queue[i] = queue[nq - 1];
+    }
+    lmask = vmd5x(mydata, queue, H, &Targets, sublen);
+    lmask &= (uint32_t) ((1ULL << nq) - 1);
+    if (lmask != 0) {
+        check_lanes(lmask, H, data, mydata, 0, queue, lanes, sublen);
+    }
+}
+
+
+/*
+ * scan_chunk() : hash the 'sublen' character substrings that start in
+ * chunk number 'chunk' of the copy of the data set at 'data' with
+ * 'vmd5', which hashes 'lanes' of them a call, and the gather kernel.
+ * The substrings may run into the next chunk.  H is scratch space for
+ * the kernel's sums.  What was done is added to the counters in 'st',
+ * the bytes and lines only on the pass for the shortest length.
+ *
+ * A substring is only hashed if it has no null in it, that is, if it
+ * lies within one line.  The nulls are found 64 bytes at a time, and
+ * between two nulls is a run of consecutive start offsets, which
+ * hash_run() hashes.  Every lane of every kernel call is a substring
+ * we need.
+ */
+void scan_chunk(int chunk, const char *data, int sublen, vmd5fn vmd5, int lanes,
+                uint32_t H[], struct statslot *st)
+{
+    const char   *mydata;      // where we start scanning
+    int           mylen;       // how many substrings start in this chunk
+    int           end;         // bytes of mydata the substrings use
+    int           base;        // offset in mydata of the 64 bytes we are on
+    uint64_t      nul;         // nulls in those bytes
+    int           z;           // offset of a null
+    int           prev;        // offset of the null before it, or -1
+    int           last;        // start of the last substring of the run
+    int32_t       queue[MAXLANES]; // leftover substrings to gather
+    int           nq;          // number of entries in queue
+    vmd5xfn       vmd5x;       // the gather kernel
+    long          nhash;       // substrings hashed
+    long          nlines;      // line ends passed
+    int           lineend;     // line ends before this are ours to count
+
+
+    vmd5x = Vmd5x;
+    mydata = data + ((long) chunk * Chunksz);
+    mylen  = (Ncand - (sublen - Sublen)) - (chunk * Chunksz);
+    if (mylen > Chunksz) {
+        mylen = Chunksz;
+    }
+    if (mylen <= 0) {
+        return;
+    }
+    end = mylen + sublen - 1;
+    lineend = (chunk == Nchunks - 1) ? end : mylen;
+
+    /* Walk the nulls, plus one at 'end', hashing the runs between them.
+     * The 64 byte reads stay within the pad after the data set. */
+    nq = 0;
+    prev = -1;
+    nhash = 0;
+    nlines = 0;
+    for (base = 0; base <= end; base += 64) {
+        nul = nul_mask(mydata + base);
+        if (base + 64 > end) {
+            nul &= ((uint64_t) 1 << (end - base)) - 1;
+            nul |= (uint64_t) 1 << (end - base);
+        }
+        while (nul != 0) {
+            z = base + __builtin_ctzll(nul);
+            nul &= nul - 1;
+            last = z - sublen;
+            if (last >= prev + 1) {
+                nhash += last - prev;
+            }
+            if (z < lineend) {
+                nlines++;
+            }
+            nq = hash_run(data, mydata, prev + 1, last, queue, nq, vmd5, vmd5x, lanes, sublen, H);
+            prev = z;
+        }
+    }
+    flush_queue(data, mydata, queue, nq, vmd5x, lanes, sublen, H);
+
+    __atomic_store_n(&st->hashed, st->hashed + nhash, __ATOMIC_RELAXED);
+    if (sublen == Sublen) {
+        __atomic_store_n(&st->bytes, st->bytes + mylen, __ATOMIC_RELAXED);
+        __atomic_store_n(&st->lines, st->lines + nlines, __ATOMIC_RELAXED);
+    }
+}
+
+
+/*
+ * scan_lines() : do what scan_chunk() does, but find the lines from
+ * the line index instead of by looking for the nulls.  The lines too
+ * short to hold a substring are passed over without reading them.
+ */
+void scan_lines(int chunk, const char *data, int sublen, vmd5fn vmd5, int lanes,
+                uint32_t H[], struct statslot *st)
+{
+    const char   *mydata;      // start of the chunk
+    long          cs;          // offset in the data set of the first substring start
+    long          ce;          // and of the one after the last
+    const struct lineent *ln;  // the line we are on
+    const struct lineent *lend; // the end of the line index
+    long          lo, hi, mid; // binary search bounds
+    long          first;       // start of the first substring of a line in the chunk
+    long          last;        // and of the last
+    int32_t       queue[MAXLANES]; // leftover substrings to gather
+    int           nq;          // number of entries in queue
+    vmd5xfn       vmd5x;       // the gather kernel
+    long          nhash;       // substrings hashed
+    long          nlines;      // line ends passed
+
+    vmd5x = Vmd5x;
+    cs = (long) chunk * Chunksz;
+    ce = cs + Chunksz;
+    if (ce > Ncand - (sublen - Sublen)) {
+        ce = Ncand - (sublen - Sublen);
+    }
+    if (ce <= cs) {
+        return;
+    }
+    mydata = data + cs;
+
+    /* Find the first line that ends after the chunk starts */
+    lo = 0;
+    hi = Nlines;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if ((long) Lines[mid].offset + Lines[mid].len > cs) {
+            hi = mid;
+        }
+        else {
+            lo = mid + 1;
+        }
+    }
+
+    nq = 0;
+    nhash = 0;
+    nlines = 0;
+    lend = Lines + Nlines;
+    for (ln = Lines + lo; (ln < lend) && (ln->offset < ce); ln++) {
+        if ((ln->offset + ln->len < ce) || (chunk == Nchunks - 1)) {
+            nlines++;
+        }
+        if (ln->len < (uint32_t) sublen) {
+            continue;
+        }
+        first = (ln->offset > cs) ? ln->offset : cs;
+        last = (long) ln->offset + ln->len - sublen;
+        if (last >= ce) {
+            last = ce - 1;
+        }
+        if (last < first) {
+            continue;
+        }
+        nhash += last - first + 1;
+        nq = hash_run(data, mydata, first - cs, last - cs, queue, nq, vmd5, vmd5x,
+                      lanes, sublen, H);
+    }
+    flush_queue(data, mydata, queue, nq, vmd5x, lanes, sublen, H);
+
+    __atomic_store_n(&st->hashed, st->hashed + nhash, __ATOMIC_RELAXED);
+    if (sublen == Sublen) {
+        __atomic_store_n(&st->bytes, st->bytes + (ce - cs), __ATOMIC_RELAXED);
+        __atomic_store_n(&st->lines, st->lines + nlines, __ATOMIC_RELAXED);
+    }
+}
+
+
+
+/*
+ * check_soa() : confirm the lanes in 'lmask' whose sums in H passed
+ * Vsoa's check, for the call that hashed the substrings starting at
+ * position 'pos' of each stream.  The streams are cut without regard
+ * for the lines, so a lane is only a substring we want if it starts
+ * before 'end' (where the chunk ends), lies within the data set and
+ * has no null in it.  The copy of the data set at 'data' gives the
+ * bytes of a match.
+ */
+static inline void check_soa(uint32_t lmask, const uint32_t H[], const char *data,
+                             long pos, long end)
+{
+    int           lane;        // lane number
+    int           n;           // its set of lanes
+    int           ngrp;        // sets of lanes that make up one row
+    long          p;           // its start in its stream
+    long          off;         // and in the data set
+    int           match;       // index of a matching target
+
+    ngrp = SOASTREAMS / Soavl;
+    while (lmask != 0) {
+        lane = __builtin_ctz(lmask);
+        lmask &= lmask - 1;
+        n = lane / Soavl;
+        p = pos + (n / ngrp);
+        off = ((((n % ngrp) * Soavl) + (lane % Soavl)) * Soa->step) + p;
+        if ((p >= end) || (off + Sublen > Datalen) || (memchr(data + off, 0, Sublen) != NULL)) {
+            continue;
+        }
+        match = probe_target(H, lane, Soavl * ngrp * Soapos);
+        if ((match >= 0) && (Targets.mask != NULL)) {
+            report_hit(H, lane, Soavl * ngrp * Soapos, data + off, Sublen, off);
+        }
+        else if (match >= 0) {
+            report_match(match, data + off, Sublen, off);
+        }
+    }
+}
+
+
+/*
+ * scan_soa() : hash the Sublen character substrings that start at the
+ * positions in chunk number 'chunk' of every stream of the interleaved
+ * copy, with Vsoa.  The substrings that cross a line end are hashed
+ * as well and dropped by check_soa() if they pass the kernel's check,
+ * which costs less than working out which they are.  'data' is the
+ * copy of the data set to report matches from, and H is scratch space
+ * for the kernel's sums.  What was done is added to the counters in
+ * 'st'.
+ */
+void scan_soa(int chunk, const char *data, uint32_t H[], struct statslot *st)
+{
+    long          cs;          // first position in the chunk
+    long          ce;          // and the one after the last
+    long          pos;         // position of the call
+    uint32_t      lmask;       // lanes that may hold a match
+    vsoafn        vsoa;        // local copy of Vsoa
+    const uint32_t *rows;      // and of Soarows
+    int           npos;        // and of Soapos
+
+    vsoa = Vsoa;
+    rows = Soarows;
+    npos = Soapos;
+    cs = (long) chunk * Chunkpos;
+    ce = cs + Chunkpos;
+    if (ce > Ncand) {
+        ce = Ncand;
+    }
+    for (pos = cs; pos < ce; pos += npos) {
+        lmask = vsoa(rows, pos, H, &Targets);
+        if (lmask != 0) {
+            check_soa(lmask, H, data, pos, ce);
+        }
+    }
+
+    __atomic_store_n(&st->hashed, st->hashed + ((ce - cs) * SOASTREAMS), __ATOMIC_RELAXED);
+    __atomic_store_n(&st->bytes, st->bytes + ((ce - cs) * SOASTREAMS), __ATOMIC_RELAXED);
+}
+
+
+/*
+ * now_ns() : the time of day in nanoseconds.
+ */
+uint64_t now_ns()
+{
+    struct timespec ts;        // the time
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return(((uint64_t) ts.tv_sec * 1000000000) + ts.tv_nsec);
+}
+
+
+/*
+ * make_stats() : create the stats segment with room for 'nthread'
+ * threads' counters.
+ */
+void make_stats(int nthread)
+{
+    int           fd;          // the segment
+
+    snprintf(Statsname, sizeof(Statsname), STATSHM, (int) getpid());
+    Statslen = sizeof(struct statshdr) + (nthread * sizeof(struct statslot));
+    (void) shm_unlink(Statsname);
+    fd = shm_open(Statsname, O_RDWR | O_CREAT, 0644);
+    if ((fd < 0) || (ftruncate(fd, Statslen) < 0)) {
+        printf("Unable to create %s\n", Statsname);
+        perror(NULL);
+        exit(1);
+    }
+    Stats = mmap((void *) 0, Statslen, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (Stats == MAP_FAILED) {
+        printf("Unable to mmap %s\n", Statsname);
+        perror(NULL);
+        exit(1);
+    }
+    close(fd);
+    Stats->magic = STATSMAGIC;
+    Slots = (struct statslot *) (Stats + 1);
+}
+
+
+/*
+ * report_progress() : until the threads are done, print a line to
+ * stderr every Interval seconds with how far the search has got, the
+ * rate over the last interval for all of the threads and for the
+ * slowest and fastest of them, and a guess at the time left.
+ */
+void report_progress()
+{
+    uint64_t      last[MXTHRD]; // each thread's count at the last report
+    uint64_t      tlast;       // time of the last report
+    uint64_t      t;           // time now
+    uint64_t      hashed;      // a thread's count now
+    uint64_t      chunks;      // chunks done by all threads
+    double        secs;        // seconds since the last report
+    double        rate;        // rate of one thread, Mhash/s
+    double        total;       // rate of all threads, Mhash/s
+    double        lo, hi;      // slowest and fastest thread
+    double        frac;        // fraction of the chunks done
+    double        elapsed;     // seconds since the start
+    struct timespec nap;       // time to sleep between checks
+    int           i;           // thread index
+    int           tick;        // number of naps since the last report
+
+    memset(last, 0, sizeof(last));
+    tlast = Stats->start;
+    nap.tv_sec = 0;
+    nap.tv_nsec = 10000000;
+    tick = 0;
+    while (__atomic_load_n(&Ndone, __ATOMIC_ACQUIRE) < Nthread) {
+        nanosleep(&nap, NULL);
+        if (++tick * 0.01 < Interval) {
+            continue;
+        }
+        tick = 0;
+        t = now_ns();
+        secs = (t - tlast) / 1e9;
+        total = 0;
+        lo = 1e30;
+        hi = 0;
+        chunks = 0;
+        for (i = 0; i < Nthread; i++) {
+            hashed = __atomic_load_n(&Slots[i].hashed, __ATOMIC_RELAXED);
+            chunks += __atomic_load_n(&Slots[i].chunks, __ATOMIC_RELAXED);
+            rate = (hashed - last[i]) / secs / 1e6;
+            last[i] = hashed;
+            total += rate;
+            lo = (rate < lo) ? rate : lo;
+            hi = (rate > hi) ? rate : hi;
+        }
+        tlast = t;
+        Stats->updated = t;
+        frac = (Nchunks > 0) ? ((double) chunks / Nchunks) : 1.0;
+        elapsed = (t - Stats->start) / 1e9;
+        fprintf(stderr, "%6.1fs %5.1f%% done  %8.1f Mhash/s  (threads %.1f to %.1f)",
+                elapsed, 100 * frac, total, lo, hi);
+        if (frac > 0) {
+            fprintf(stderr, "  %.1fs left", elapsed * (1 - frac) / frac);
+        }
+        fprintf(stderr, "\n");
+    }
+}
+
+
+/*
+ * print_summary() : print to stderr how many substrings were hashed
+ * and how fast, and with -s the same for each thread.
+ */
+void print_summary()
+{
+    uint64_t      hashed;      // substrings hashed by all threads
+    uint64_t      cycles;      // cycles spent by all threads
+    double        secs;        // length of the search
+    int           i;           // thread index
+
+    secs = (Stats->updated - Stats->start) / 1e9;
+    if (secs <= 0) {
+        secs = 1e-9;
+    }
+    hashed = 0;
+    cycles = 0;
+    for (i = 0; i < Nthread; i++) {
+        hashed += Slots[i].hashed;
+        cycles += Slots[i].cycles;
+        if (Interval > 0) {
+            fprintf(stderr, "thread %2d: %lu hashed, %lu lines, %.1f Mhash/s, %.1f cycles/hash\n",
+                    i, (unsigned long) Slots[i].hashed, (unsigned long) Slots[i].lines,
+                    Slots[i].hashed / secs / 1e6,
+                    (Slots[i].hashed > 0) ? ((double) Slots[i].cycles / Slots[i].hashed) : 0.0);
+        }
+    }
+    fprintf(stderr, "Hashed %lu substrings in %.3fs, %.1f Mhash/s",
+            (unsigned long) hashed, secs, hashed / secs / 1e6);
+    if (hashed > 0) {
+        fprintf(stderr, ", %.1f cycles/hash", (double) cycles / hashed);
+    }
+    fprintf(stderr, "\n");
+}
+
+
+/*
+ * find_nodes() : fill in Nodes with the NUMA nodes that have cpus we
+ * are allowed to run on, and find the cores those cpus make up.
+ * Without /sys/devices/system/node all of our cpus go in one node.
+ */
+void find_nodes()
+{
+    cpu_set_t     allowed;     // cpus we may run on
+    cpu_set_t     list;        // the cpus in a node or a core
+    DIR          *dir;         // /sys/devices/system/node
+    struct dirent *ent;        // an entry in dir
+    char          path[MAXNAMELEN]; // a node's cpulist file
+    int           id;          // node number
+    int           cpu;         // generic cpu number
+    int           n, i, j;     // generic loop index
+    NUMANODE     *nd;          // the node being filled in
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        CPU_ZERO(&allowed);
+        CPU_SET(0, &allowed);
+    }
+    Nnodes = 0;
+    dir = opendir("/sys/devices/system/node");
+    while ((dir != NULL) && ((ent = readdir(dir)) != NULL) && (Nnodes < MAXNODES)) {
+        if (sscanf(ent->d_name, "node%d", &id) != 1) {
+            continue;
+        }
+        snprintf(path, MAXNAMELEN, "/sys/devices/system/node/%s/cpulist", ent->d_name);
+        CPU_ZERO(&list);
+        if (read_cpulist(path, &list) != 0) {
+            continue;
+        }
+        nd = &Nodes[Nnodes];
+        nd->id = id;
+        nd->ncpu = 0;
+        nd->cpus = malloc(MAXCPUS * sizeof(int));
+        for (cpu = 0; (cpu < CPU_SETSIZE) && (nd->ncpu < MAXCPUS); cpu++) {
+            if (CPU_ISSET(cpu, &list) && CPU_ISSET(cpu, &allowed)) {
+                nd->cpus[nd->ncpu++] = cpu;
+            }
+        }
+        if (nd->ncpu > 0) {
+            Nnodes++;
+        }
+        else {
+            free(nd->cpus);
+        }
+    }
+    if (dir != NULL) {
+        closedir(dir);
+    }
+
+    if (Nnodes == 0) {
+        nd = &Nodes[0];
+        nd->id = 0;
+        nd->ncpu = 0;
+        nd->cpus = malloc(MAXCPUS * sizeof(int));
+        for (cpu = 0; (cpu < CPU_SETSIZE) && (nd->ncpu < MAXCPUS); cpu++) {
+            if (CPU_ISSET(cpu, &allowed)) {
+                nd->cpus[nd->ncpu++] = cpu;
+            }
+        }
+        Nnodes = 1;
+    }
+
+    /* A cpu starts a core unless one of the node's cpus before it is
+     * its SMT sibling.  One whose siblings cannot be read is taken to
+     * be a core of its own. */
+    for (n = 0; n < Nnodes; n++) {
+        nd = &Nodes[n];
+        nd->ncore = 0;
+        nd->cores = malloc(nd->ncpu * sizeof(int));
+        for (i = 0; i < nd->ncpu; i++) {
+            snprintf(path, MAXNAMELEN, CPUSYS "/cpu%d/topology/thread_siblings_list",
+                     nd->cpus[i]);
+            CPU_ZERO(&list);
+            (void) read_cpulist(path, &list);
+            for (j = 0; (j < i) && !CPU_ISSET(nd->cpus[j], &list); j++)
+                ;
+            if (j == i) {
+                nd->cores[nd->ncore++] = nd->cpus[i];
+            }
+        }
+    }
+}
+
+
+/*
+ * read_cpulist() : add the cpus in the cpulist file 'path', which looks
+ * like 0-3,8-11, to 'set'.  Return -1 if the file cannot be opened.
+ */
+int read_cpulist(const char *path, cpu_set_t *set)
+{
+    FILE         *fp;          // the cpulist file
+    int           lo, hi;      // a range of cpus in it
+    int           cpu;         // generic cpu number
+    char          sep;         // separator after a range
+
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        return(-1);
+    }
+    while (fscanf(fp, "%d", &lo) == 1) {
+        hi = lo;
+        sep = (char) fgetc(fp);
+        if ((sep == '-') && (fscanf(fp, "%d", &hi) == 1)) {
+            sep = (char) fgetc(fp);
+        }
+        for (cpu = lo; (cpu <= hi) && (cpu < CPU_SETSIZE); cpu++) {
+            CPU_SET(cpu, set);
+        }
+        if (sep != ',') {
+            break;
+        }
+    }
+    fclose(fp);
+    return(0);
+}
+
+
+/*
+ * place_threads() : pick a cpu and node for each thread.  With -p the
+ * threads are dealt out to the nodes in turn so each node gets its
+ * share, and within a node to its cpus in turn, or when Pin is 2 to
+ * the first cpu of each of its cores in turn, leaving the SMT siblings
+ * idle.  Every thread scans the shared data set until make_replicas()
+ * says otherwise.
+ */
+void place_threads()
+{
+    int           i;           // thread index
+    NUMANODE     *nd;          // the thread's node
+
+    for (i = 0; i < Nthread; i++) {
+        Thrds[i].thread_idx = i;
+        Thrds[i].data = Dataset;
+        Thrds[i].cpu = -1;
+        Thrds[i].node = i % Nnodes;
+        if (Pin == 2) {
+            nd = &Nodes[Thrds[i].node];
+            Thrds[i].cpu = nd->cores[(i / Nnodes) % nd->ncore];
+        }
+        else if (Pin) {
+            nd = &Nodes[Thrds[i].node];
+            Thrds[i].cpu = nd->cpus[(i / Nnodes) % nd->ncpu];
+        }
+    }
+}
+
+
+/*
+ * make_replicas() : give each node that has threads on it a copy of
+ * the data set in its own memory, and point its threads at it.  The
+ * copy is in huge pages if any are reserved, else transparent huge
+ * pages are requested.  mbind() puts the pages on the node no matter
+ * which cpu does the copy.
+ */
+void make_replicas()
+{
+    int           i;           // generic loop index
+    NUMANODE     *nd;          // the node being copied to
+    size_t        len;         // size of a copy, rounded up to a huge page
+    unsigned long nodemask[MAXNODES / 64 + 1]; // the node as a mask for mbind()
+    char         *copy;        // the new copy
+
+    len = ((size_t) Shmlen + HUGEPAGESZ - 1) & ~((size_t) HUGEPAGESZ - 1);
+    for (i = 0; i < Nnodes; i++) {
+        nd = &Nodes[i];
+        nd->data = NULL;
+        if ((i >= Nthread) || (Nnodes == 1)) {
+            nd->data = Dataset;   // no threads here, or nothing to gain
+            continue;
+        }
+        copy = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (copy == MAP_FAILED) {
+            copy = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (copy == MAP_FAILED) {
+                printf("Unable to allocate a copy of the data set for node %d\n", nd->id);
+                perror(NULL);
+                exit(1);
+            }
+            (void) madvise(copy, len, MADV_HUGEPAGE);
+        }
+        memset(nodemask, 0, sizeof(nodemask));
+        if (nd->id < MAXNODES) {
+            nodemask[nd->id / 64] = 1UL << (nd->id % 64);
+            if (syscall(SYS_mbind, copy, len, MPOL_BIND, nodemask, MAXNODES + 1, 0) != 0) {
+                printf("Warning: unable to bind data set copy to node %d\n", nd->id);
+            }
+        }
+        memcpy(copy, Dataset, Shmlen);
+        (void) mprotect(copy, len, PROT_READ);
+        nd->data = copy;
+        nd->datasz = len;
+    }
+    for (i = 0; i < Nthread; i++) {
+        Thrds[i].data = Nodes[Thrds[i].node].data;
+    }
+}
+
+
+
+/*
+ * The loadw_*() routines return a vector whose lane i holds the 32
+ * bit word at p + i.  Consecutive lanes overlap by three bytes, so
+ * one short load has the bytes for every lane and a shuffle (or
+ * byte shifts on SSE2) spreads them out.
+ */
+static inline uint32_t loadw_scalar(const char *p)
+{
+    uint32_t     w;
+
+    memcpy(&w, p, sizeof(w));
+    return(w);
+}
+
+static inline __m128i loadw_sse2(const char *p)
+{
+    __m128i      v;           // bytes p[0] to p[7]
+
+    v = _mm_loadl_epi64((const __m128i *) p);
+    return(_mm_unpacklo_epi64(
+               _mm_unpacklo_epi32(v, _mm_srli_si128(v, 1)),
+               _mm_unpacklo_epi32(_mm_srli_si128(v, 2), _mm_srli_si128(v, 3))));
+}
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+static inline __m256i loadw_avx2(const char *p)
+{
+    // lanes 0-3 use bytes 0-6 and lanes 4-7 use bytes 4-10
+    const __m256i shuf = _mm256_setr_epi8(0, 1, 2, 3, 1, 2, 3, 4, 2, 3, 4, 5, 3, 4, 5, 6,
+                                          4, 5, 6, 7, 5, 6, 7, 8, 6, 7, 8, 9, 7, 8, 9, 10);
+
+    return(_mm256_shuffle_epi8(
+               _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) p)), shuf));
+}
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bw")
+static inline __m512i loadw_avx512(const char *p)
+{
+    // 128 bit blocks 0 and 1 get bytes 0-15, blocks 2 and 3 get bytes 8-23
+    const __m512i widx = _mm512_setr_epi32(0, 1, 2, 3, 0, 1, 2, 3, 2, 3, 4, 5, 2, 3, 4, 5);
+    const __m512i shuf = _mm512_broadcast_i64x4(
+                             _mm256_setr_epi8(0, 1, 2, 3, 1, 2, 3, 4, 2, 3, 4, 5, 3, 4, 5, 6,
+                                              4, 5, 6, 7, 5, 6, 7, 8, 6, 7, 8, 9, 7, 8, 9, 10));
+    __m512i      v;           // bytes p[0] to p[19]
+
+    v = _mm512_maskz_loadu_epi32(0x001f, p);
+    return(_mm512_shuffle_epi8(_mm512_permutexvar_epi32(widx, v), shuf));
+}
+#pragma GCC pop_options
+
+
+/*
+ * The gatherw_*() routines return a vector whose lane i holds the 32
+ * bit word at p + off[i], for substrings that are not next to each
+ * other.  AVX2 and AVX-512 have gather instructions for this.
+ */
+static inline uint32_t gatherw_scalar(const char *p, const int32_t off[])
+{
+    return(loadw_scalar(p + off[0]));
+}
+
+static inline __m128i gatherw_sse2(const char *p, const int32_t off[])
+{
+    return(_mm_setr_epi32(loadw_scalar(p + off[0]), loadw_scalar(p + off[1]),
+                          loadw_scalar(p + off[2]), loadw_scalar(p + off[3])));
+}
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+static inline __m256i gatherw_avx2(const char *p, const int32_t off[])
+{
+    return(_mm256_i32gather_epi32((const int *) p,
+                                  _mm256_loadu_si256((const __m256i *) off), 1));
+}
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bw")
+static inline __m512i gatherw_avx512(const char *p, const int32_t off[])
+{
+    return(_mm512_i32gather_epi32(_mm512_loadu_si512(off), p, 1));
+}
+#pragma GCC pop_options
+
+
+    /* Scalar kernels, one lane */
+#define VMASK(c)        ((uint32_t) (c))
+#define VLOADW(p)       loadw_scalar(p)
+#define VGATHERW(p, o)  gatherw_scalar(p, o)
+#define VL 1
+#define VSETS SETS_SCALAR
+#define VNAME(n) n##_scalar
+#include "vmd5_kernel.h"
+#include "vsha_kernel.h"
+#undef VL
+#undef VSETS
+#undef VNAME
+
+    /* SSE2 kernels, 4 lanes.  SSE2 is in every x86-64 cpu. */
+#undef VMASK
+#define VMASK(c)        ((uint32_t) _mm_movemask_ps((__m128) (c)))
+#undef VLOADW
+#undef VGATHERW
+#define VLOADW(p)       ((VNAME(vecui)) loadw_sse2(p))
+#define VGATHERW(p, o)  ((VNAME(vecui)) gatherw_sse2(p, o))
+#define VL 4
+#define VSETS SETS_SSE2
+#define VNAME(n) n##_sse2
+#include "vmd5_kernel.h"
+#include "vsha_kernel.h"
+#undef VL
+#undef VSETS
+#undef VNAME
+
+    /* AVX2 kernels, 8 lanes */
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#undef VMASK
+#define VMASK(c)        ((uint32_t) _mm256_movemask_ps((__m256) (c)))
+#undef VLOADW
+#undef VGATHERW
+#define VLOADW(p)       ((VNAME(vecui)) loadw_avx2(p))
+#define VGATHERW(p, o)  ((VNAME(vecui)) gatherw_avx2(p, o))
+#define VL 8
+#define VSETS SETS_AVX2
+#define VNAME(n) n##_avx2
+#include "vmd5_kernel.h"
+#include "vsha_kernel.h"
+#undef VL
+#undef VSETS
+#undef VNAME
+#pragma GCC pop_options
+
+    /* AVX-512 kernels, 16 lanes.  Use the native rotate (vprold) and
+     * do each of F, G, H and I in one ternary logic (vpternlogd).
+     * The loader needs the byte shuffle from AVX-512BW. */
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bw")
+#undef F
+#undef G
+#undef H
+#undef I
+#undef ROTATE
+#define TERNLOG(b,c,d,imm) ((VNAME(vecui)) _mm512_ternarylogic_epi32( \
+        (__m512i) (b), (__m512i) (c), (__m512i) (d), (imm)))
+#define F(b,c,d)        TERNLOG(b,c,d,0xca)
+#define G(b,c,d)        TERNLOG(b,c,d,0xe4)
+#define H(b,c,d)        TERNLOG(b,c,d,0x96)
+#define I(b,c,d)        TERNLOG(b,c,d,0x39)
+#define ROTATE(a, s)    ((VNAME(vecui)) _mm512_rol_epi32((__m512i) (a), (s)))
+#undef VMASK
+#define VMASK(c)        ((uint32_t) _mm512_test_epi32_mask((__m512i) (c), (__m512i) (c)))
+#undef VLOADW
+#undef VGATHERW
+#define VLOADW(p)       ((VNAME(vecui)) loadw_avx512(p))
+#define VGATHERW(p, o)  ((VNAME(vecui)) gatherw_avx512(p, o))
+#define VL 16
+#define VSETS SETS_AVX512
+#define VNAME(n) n##_avx512
+#include "vmd5_kernel.h"
+#include "vsha_kernel.h"
+#undef VL
+#undef VSETS
+#undef VNAME
+#undef F
+#undef G
+#undef H
+#undef I
+#undef ROTATE
+#undef TERNLOG
+#undef VMASK
+#undef VLOADW
+#undef VGATHERW
+#define F(b,c,d)        ((((c) ^ (d)) & (b)) ^ (d))
+#define G(b,c,d)        ((((b) ^ (c)) & (d)) ^ (c))
+#define H(b,c,d)        ((b) ^ (c) ^ (d))
+#define I(b,c,d)        (((~(d)) | (b)) ^ (c))
+#define ROTATE(a, s) ((a << s) + (a >> (32 - s)))
+#pragma GCC pop_options
+
+
+    /* All of the kernels for each hash, fastest first.  The tables
+     * list the same instruction sets in the same order.  Only the MD5
+     * kernels, and not the scalar ones, read the interleaved copy. */
+struct vkernel Md5kernels[] = {
+    { "avx512", 16, SETS_AVX512, Vmd5tab_avx512, vmd5_gather_avx512,
+      Vsoatab_avx512, SOAPOS(16, SETS_AVX512) },
+    { "avx2",    8, SETS_AVX2,   Vmd5tab_avx2,   vmd5_gather_avx2,
+      Vsoatab_avx2, SOAPOS(8, SETS_AVX2) },
+    { "sse2",    4, SETS_SSE2,   Vmd5tab_sse2,   vmd5_gather_sse2,
+      Vsoatab_sse2, SOAPOS(4, SETS_SSE2) },
+    { "scalar",  1, SETS_SCALAR, Vmd5tab_scalar, vmd5_gather_scalar, NULL, 0 },
+};
+#define NKERNELS ((int) (sizeof(Md5kernels) / sizeof(Md5kernels[0])))
+
+struct vkernel Sha1kernels[NKERNELS] = {
+    { "avx512", 16, 1, Vsha1tab_avx512, vsha1_gather_avx512, NULL, 0 },
+    { "avx2",    8, 1, Vsha1tab_avx2,   vsha1_gather_avx2,   NULL, 0 },
+    { "sse2",    4, 1, Vsha1tab_sse2,   vsha1_gather_sse2,   NULL, 0 },
+    { "scalar",  1, 1, Vsha1tab_scalar, vsha1_gather_scalar, NULL, 0 },
+};
+
+struct vkernel Sha256kernels[NKERNELS] = {
+    { "avx512", 16, 1, Vsha256tab_avx512, vsha256_gather_avx512, NULL, 0 },
+    { "avx2",    8, 1, Vsha256tab_avx2,   vsha256_gather_avx2,   NULL, 0 },
+    { "sse2",    4, 1, Vsha256tab_sse2,   vsha256_gather_sse2,   NULL, 0 },
+    { "scalar",  1, 1, Vsha256tab_scalar, vsha256_gather_scalar, NULL, 0 },
+};
+
+
+/*
+ * cpu_has() : return non-zero if this cpu (and OS) supports the
+ * instruction set of the kernels k.
+ */
+static int cpu_has(struct vkernel *k)
+{
+    __builtin_cpu_init();
+    if (strcmp(k->name, "avx512") == 0)
+        return(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"));
+    if (strcmp(k->name, "avx2") == 0)
+        return(__builtin_cpu_supports("avx2"));
+    if (strcmp(k->name, "sse2") == 0)
+        return(__builtin_cpu_supports("sse2"));
+    return(1);
+}
+
+
+/*
+ * pick_kernel() : return the kernels for Hash named 'name', or the
+ * fastest kernels this cpu supports if name is NULL.  Exit if the
+ * named kernels do not exist or can not run here.
+ */
+struct vkernel *pick_kernel(const char *name)
+{
+    int          k;           // index into Hash->kernels
+
+    for (k = 0; k < NKERNELS; k++) {
+        if ((name != NULL) && (strcmp(name, Hash->kernels[k].name) != 0))
+            continue;
+        if (cpu_has(&Hash->kernels[k]))
+            return(&Hash->kernels[k]);
+        if (name != NULL) {
+            printf("This cpu does not support the %s kernel\n", name);
+            exit(1);
+        }
+    }
+    printf("Unknown kernel '%s'.  Use one of:", name);
+    for (k = 0; k < NKERNELS; k++)
+        printf(" %s", Hash->kernels[k].name);
+    printf("\n");
+    exit(1);
+}
+
+
+/*
+ * md5_ref() : the plain one lane MD5 sum of the 'len' characters at
+ * 'str', straight from RFC 1321, to check the kernels against.
+ */
+static void md5_ref(const char *str, int len, uint32_t sum[4])
+{
+    static const uint32_t k[64] = {
+        0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
+        0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+        0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+        0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+        0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
+        0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+        0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
+        0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+        0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+        0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+        0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
+        0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+        0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
+        0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+        0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+        0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+    };
+    static const int r[16] = { 7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21 };
+    uint8_t      msg[128];    // the padded message
+    int          nblk;        // number of 64 byte blocks in msg
+    uint32_t     x[16];       // the words of a block
+    uint32_t     a, b, c, d;  // md5 state
+    uint32_t     f, tmp;      // round function and step temporary
+    int          blk, i, g;   // block, step and word indexes
+    uint64_t     bits;        // message length in bits
+
+    nblk = (len + 8) / 64 + 1;
+    memset(msg, 0, sizeof(msg));
+    memcpy(msg, str, len);
+    msg[len] = 0x80;
+    bits = (uint64_t) len * 8;
+    memcpy(msg + (nblk * 64) - 8, &bits, 8);
+
+    sum[0] = 0x67452301;
+    sum[1] = 0xefcdab89;
+    sum[2] = 0x98badcfe;
+    sum[3] = 0x10325476;
+    for (blk = 0; blk < nblk; blk++) {
+        memcpy(x, msg + (blk * 64), 64);
+        a = sum[0];
+        b = sum[1];
+        c = sum[2];
+        d = sum[3];
+        for (i = 0; i < 64; i++) {
+            if (i < 16) {
+                f = (b & c) | (~b & d);
+                g = i;
+            }
+            else if (i < 32) {
+                f = (d & b) | (~d & c);
+                g = (5 * i + 1) % 16;
+            }
+            else if (i < 48) {
+                f = b ^ c ^ d;
+                g = (3 * i + 5) % 16;
+            }
+            else {
+                f = c ^ (b | ~d);
+                g = (7 * i) % 16;
+            }
+            tmp = d;
+            d = c;
+            c = b;
+            f = a + f + k[i] + x[g];
+            b = b + ((f << r[(i / 16) * 4 + (i % 4)]) | (f >> (32 - r[(i / 16) * 4 + (i % 4)])));
+            a = tmp;
+        }
+        sum[0] += a;
+        sum[1] += b;
+        sum[2] += c;
+        sum[3] += d;
+    }
+}
+
+
+/*
+ * kernel_lanes() : the number of substrings a kernel of 'k' for
+ * 'sublen' hashes in one call.
+ */
+int kernel_lanes(struct vkernel *k, int sublen)
+{
+    return(k->lanes * ((sublen > MAXONEBLK) ? 2 : k->sets));
+}
+
+
+/*
+ * sha_pad() : put the 'len' characters at 'str' in msg, padded for
+ * SHA-1 and SHA-256, and return the number of 64 byte blocks.
+ */
+static int sha_pad(const char *str, int len, uint8_t msg[128])
+{
+    int          nblk;        // number of 64 byte blocks in msg
+    uint64_t     bits;        // message length in bits
+
+    nblk = (len + 8) / 64 + 1;
+    memset(msg, 0, 128);
+    memcpy(msg, str, len);
+    msg[len] = 0x80;
+    bits = __builtin_bswap64((uint64_t) len * 8);
+    memcpy(msg + (nblk * 64) - 8, &bits, 8);
+    return(nblk);
+}
+
+
+/*
+ * sha1_ref() : the plain one lane SHA-1 sum of the 'len' characters
+ * at 'str', straight from FIPS 180-4, to check the kernels against.
+ */
+static void sha1_ref(const char *str, int len, uint32_t sum[5])
+{
+    uint8_t      msg[128];    // the padded message
+    int          nblk;        // number of 64 byte blocks in msg
+    uint32_t     w[80];       // the message schedule
+    uint32_t     a, b, c, d, e; // sha1 state
+    uint32_t     f, k, tmp;   // round function, constant and temporary
+    int          blk, i;      // block and round indexes
+
+    nblk = sha_pad(str, len, msg);
+    sum[0] = 0x67452301;
+    sum[1] = 0xefcdab89;
+    sum[2] = 0x98badcfe;
+    sum[3] = 0x10325476;
+    sum[4] = 0xc3d2e1f0;
+    for (blk = 0; blk < nblk; blk++) {
+        for (i = 0; i < 16; i++) {
+            memcpy(&w[i], msg + (blk * 64) + (4 * i), 4);
+            w[i] = __builtin_bswap32(w[i]);
+        }
+        for (i = 16; i < 80; i++) {
+            tmp = w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16];
+            w[i] = (tmp << 1) | (tmp >> 31);
+        }
+        a = sum[0];
+        b = sum[1];
+        c = sum[2];
+        d = sum[3];
+        e = sum[4];
+        for (i = 0; i < 80; i++) {
+            if (i < 20) {
+                f = (b & c) | (~b & d);
+                k = 0x5a827999;
+            }
+            else if (i < 40) {
+                f = b ^ c ^ d;
+                k = 0x6ed9eba1;
+            }
+            else if (i < 60) {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8f1bbcdc;
+            }
+            else {
+                f = b ^ c ^ d;
+                k = 0xca62c1d6;
+            }
+            tmp = ((a << 5) | (a >> 27)) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = (b << 30) | (b >> 2);
+            b = a;
+            a = tmp;
+        }
+        sum[0] += a;
+        sum[1] += b;
+        sum[2] += c;
+        sum[3] += d;
+        sum[4] += e;
+    }
+}
+
+
+/*
+ * sha256_ref() : the plain one lane SHA-256 sum of the 'len'
+ * characters at 'str', straight from FIPS 180-4, to check the kernels
+ * against.
+ */
+static void sha256_ref(const char *str, int len, uint32_t sum[8])
+{
+    static const uint32_t k[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+        0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+        0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+        0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+        0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+        0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+        0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+        0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+        0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+    };
+    static const uint32_t iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    uint8_t      msg[128];    // the padded message
+    int          nblk;        // number of 64 byte blocks in msg
+    uint32_t     w[64];       // the message schedule
+    uint32_t     v[8];        // sha256 state, a to h
+    uint32_t     s0, s1;      // sigmas
+    uint32_t     t1, t2;      // round temporaries
+    int          blk, i;      // block and round indexes
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+    nblk = sha_pad(str, len, msg);
+    memcpy(sum, iv, sizeof(iv));
+    for (blk = 0; blk < nblk; blk++) {
+        for (i = 0; i < 16; i++) {
+            memcpy(&w[i], msg + (blk * 64) + (4 * i), 4);
+            w[i] = __builtin_bswap32(w[i]);
+        }
+        for (i = 16; i < 64; i++) {
+            s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        memcpy(v, sum, sizeof(v));
+        for (i = 0; i < 64; i++) {
+            s1 = ROTR(v[4], 6) ^ ROTR(v[4], 11) ^ ROTR(v[4], 25);
+            t1 = v[7] + s1 + ((v[4] & v[5]) ^ (~v[4] & v[6])) + k[i] + w[i];
+            s0 = ROTR(v[0], 2) ^ ROTR(v[0], 13) ^ ROTR(v[0], 22);
+            t2 = s0 + ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+            memmove(v + 1, v, 7 * sizeof(v[0]));
+            v[4] += t1;
+            v[0] = t1 + t2;
+        }
+        for (i = 0; i < 8; i++) {
+            sum[i] += v[i];
+        }
+    }
+#undef ROTR
+}
+
+
+    /* The hashes -H takes, the default first */
+struct hashalg Hashes[] = {
+    { "md5",    "MD5",     4, 0, Md5kernels,    md5_ref },
+    { "sha1",   "SHA-1",   5, 1, Sha1kernels,   sha1_ref },
+    { "sha256", "SHA-256", 8, 1, Sha256kernels, sha256_ref },
+};
+#define NHASHES ((int) (sizeof(Hashes) / sizeof(Hashes[0])))
+
+
+/*
+ * pick_hash() : return the hash named 'name', or MD5 if name is NULL.
+ * Exit if there is no such hash.
+ */
+struct hashalg *pick_hash(const char *name)
+{
+    int          h;           // index into Hashes
+
+    if (name == NULL)
+        return(&Hashes[0]);
+    for (h = 0; h < NHASHES; h++) {
+        if (strcmp(name, Hashes[h].name) == 0)
+            return(&Hashes[h]);
+    }
+    printf("Unknown hash '%s'.  Use one of:", name);
+    for (h = 0; h < NHASHES; h++)
+        printf(" %s", Hashes[h].name);
+    printf("\n");
+    exit(1);
+}
+
+
+/*
+ * bench_rand() : the next number from a xorshift generator.  The
+ * benchmark wants the same data every run, not good random numbers.
+ */
+static uint64_t bench_rand(uint64_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return(*state);
+}
+
+
+/*
+ * check_kernels() : compare every lane of the kernels 'kern' (or of
+ * all the kernels this cpu supports if kern is NULL) against
+ * Hash->ref() on random strings of every length, for both the kernels
+ * that load consecutive substrings and the gather kernel.  Print a
+ * line per instruction set and return the number of wrong sums.
+ */
+long check_kernels(struct vkernel *kern)
+{
+    char         buf[MAXLANES + MAXSUBLEN + 64]; // random strings
+    int32_t      off[MAXLANES]; // random offsets into buf for the gather kernel
+    uint32_t     H[MAXWORDS * MAXLANES]; // sums from a kernel
+    uint32_t     ref[MAXWORDS]; // sum from Hash->ref()
+    uint64_t     allbits;     // prefilter bitmap that passes every lane
+    union targetsum one;      // target for the single target check
+    char         onedone;     // Targets.done for it
+    struct targetset t;       // targets for the kernels
+    uint64_t     seed;        // random number state
+    struct vkernel *k;        // the kernels being checked
+    int          kx;          // index into Hash->kernels
+    int          len;         // substring length
+    int          lanes;       // substrings per kernel call
+    int          round;       // test round
+    int          lane;        // lane being checked
+    uint32_t     mask;        // lanes returned by a kernel
+    int          i, j;        // generic loop indexes
+    int          w;           // word of a sum
+    int          bad;         // a lane's sum is wrong
+    long         nsum;        // sums checked for this instruction set
+    long         nbad;        // wrong sums for this instruction set
+    long         totbad;      // wrong sums for all of them
+
+    seed = 0x5eed5eed5eedULL;
+    totbad = 0;
+    for (kx = 0; kx < NKERNELS; kx++) {
+        k = &Hash->kernels[kx];
+        if (((kern != NULL) && (k != kern)) || !cpu_has(k)) {
+            continue;
+        }
+        nsum = 0;
+        nbad = 0;
+        for (len = MINSUBLEN; len <= MAXSUBLEN; len++) {
+            lanes = kernel_lanes(k, len);
+            for (round = 0; round < 8; round++) {
+                for (i = 0; i < (int) sizeof(buf); i++) {
+                    buf[i] = (char) (bench_rand(&seed) % 255 + 1);
+                }
+                for (i = 0; i < lanes; i++) {
+                    off[i] = bench_rand(&seed) % (MAXLANES + 1);
+                }
+
+                /* A bitmap with every bit set passes every lane, so
+                 * all of the sums come back */
+                allbits = ~0ULL;
+                memset(&t, 0, sizeof(t));
+                t.count = 2;
+                t.bitmap = &allbits;
+                t.bmask = 0;
+                for (j = 0; j < 2; j++) {
+                    memset(H, 0, sizeof(H));
+                    if (j == 0) {
+                        mask = k->tab[len](buf, H, &t);
+                    }
+                    else {
+                        mask = k->gather(buf, off, H, &t, len);
+                    }
+                    for (lane = 0; lane < lanes; lane++) {
+                        Hash->ref(buf + ((j == 0) ? lane : off[lane]), len, ref);
+                        nsum++;
+                        bad = (((mask >> lane) & 1) == 0);
+                        for (w = 0; w < Hash->nwords; w++) {
+                            bad |= (H[(w * lanes) + lane] != ref[w]);
+                        }
+                        if (bad) {
+                            if (nbad++ < 10) {
+                                printf("%s: wrong sum for length %d lane %d%s\n", k->name,
+                                       len, lane, (j == 0) ? "" : " (gather)");
+                            }
+                        }
+                    }
+                }
+
+                /* A single target is found by the vector compare */
+                lane = bench_rand(&seed) % lanes;
+                Hash->ref(buf + lane, len, one.i);
+                onedone = 0;
+                t.count = 1;
+                t.sums = &one;
+                t.done = &onedone;
+                mask = k->tab[len](buf, H, &t);
+                nsum++;
+                if ((((mask >> lane) & 1) == 0) || (H[lane] != one.i[0]) ||
+                    (H[((Hash->nwords - 1) * lanes) + lane] != one.i[Hash->nwords - 1])) {
+                    if (nbad++ < 10) {
+                        printf("%s: single target missed for length %d lane %d\n",
+                               k->name, len, lane);
+                    }
+                }
+            }
+        }
+        printf("%s: %ld sums checked, %ld wrong\n", k->name, nsum, nbad);
+        totbad += nbad;
+    }
+    return(totbad);
+}
+
+
+/*
+ * make_corpus() : build a data set of 'size' bytes of random lower
+ * case words in lines of 'minline' to 'maxline' characters, each
+ * ended by a null like shm_init does, in a shared memory segment of
+ * our own.  The segment is unlinked at once so no one else sees it
+ * and it goes away when we exit.
+ */
+void make_corpus(long size, int minline, int maxline)
+{
+    char          name[64];    // name of the segment
+    uint64_t      seed;        // random number state
+    uint64_t      rnd;         // a random number
+    long          pos;         // where the next line goes
+    int           len;         // length of the line
+    int           i;           // generic loop index
+
+    snprintf(name, sizeof(name), "/gutenberg.bench.%d", (int) getpid());
+    Fdshm = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (Fdshm < 0) {
+        printf("Unable to create %s\n", name);
+        perror(NULL);
+        exit(1);
+    }
+    (void) shm_unlink(name);
+    Shmlen = size + DATAPAD;
+    if (ftruncate(Fdshm, Shmlen) < 0) {
+        printf("Unable to size %s\n", name);
+        perror(NULL);
+        exit(1);
+    }
+    Dataset = mmap((void *) 0, Shmlen, PROT_READ | PROT_WRITE, MAP_SHARED, Fdshm, 0);
+    if (Dataset == MAP_FAILED) {
+        printf("Unable to mmap %s\n", name);
+        perror(NULL);
+        exit(1);
+    }
+    (void) madvise(Dataset, Shmlen, MADV_HUGEPAGE);
+
+    seed = 0x9e3779b97f4a7c15ULL;
+    for (pos = 0; pos < size; pos += len + 1) {
+        len = minline + (int) (bench_rand(&seed) % (maxline - minline + 1));
+        if (pos + len >= size) {
+            len = size - pos - 1;
+        }
+        for (i = 0; i < len; i++) {
+            rnd = bench_rand(&seed);
+            Dataset[pos + i] = ((rnd & 7) == 0) ? ' ' : (char) ('a' + ((rnd >> 3) % 26));
+        }
+        Dataset[pos + len] = (char) 0;
+    }
+    Datalen = size;
+}
+
+
+/*
+ * count_substrings() : the number of Sublen character substrings in
+ * the lines of the data set, which is how many sums a search does.
+ */
+long count_substrings()
+{
+    const char   *p;           // start of a line
+    const char   *nul;         // its end
+    long          n;           // substrings so far
+
+    n = 0;
+    for (p = Dataset; p < Dataset + Datalen; p = nul + 1) {
+        nul = memchr(p, 0, Dataset + Datalen - p);
+        if (nul == NULL) {
+            nul = Dataset + Datalen;
+        }
+        if (nul - p >= Sublen) {
+            n += (nul - p) - Sublen + 1;
+        }
+    }
+    return(n);
+}
+
+
+/*
+ * run_bench() : check the kernels against Hash->ref(), then time full
+ * searches of a synthetic corpus of 'mb' megabytes with lines of
+ * 'minline' to 'maxline' characters.  Every kernel this cpu supports
+ * (or just 'kern') is timed at each substring length (or just Sublen
+ * if 'onelen') with 1, 2, 4 ... up to 'maxthread' threads.  Return
+ * non-zero if any kernel computes a wrong sum.
+ */
+int run_bench(struct vkernel *kern, int onelen, long mb, int minline, int maxline, int maxthread)
+{
+    static const int lens[] = { 19, 22, 32, 44, 55, 56, 64, 90, 119 };
+    int           nlens;       // number of lengths to time
+    int           lx;          // index into lens
+    int           kx;          // index into Hash->kernels
+    struct vkernel *k;         // the kernels being timed
+    long          nhash;       // sums a search does
+    struct timespec t0, t1;    // start and end of a search
+    double        secs;        // how long it took
+
+    printf("Checking the %s kernels against a reference %s\n", Hash->name, Hash->label);
+    if (check_kernels(kern) != 0) {
+        printf("Kernel check FAILED\n");
+        return(1);
+    }
+
+    make_corpus(mb * 1024 * 1024, minline, maxline);
+    printf("Synthetic corpus of %ld MB, lines of %d to %d characters\n", mb, minline, maxline);
+    Nthread = maxthread;
+    find_nodes();
+    place_threads();
+    if (Replicate) {
+        make_replicas();
+    }
+
+    nlens = onelen ? 1 : (int) (sizeof(lens) / sizeof(lens[0]));
+    printf("kernel  length threads  seconds   Mhash/s\n");
+    for (kx = 0; kx < NKERNELS; kx++) {
+        k = &Hash->kernels[kx];
+        if (((kern != NULL) && (k != kern)) || !cpu_has(k)) {
+            continue;
+        }
+        for (lx = 0; lx < nlens; lx++) {
+            if (!onelen) {
+                Sublen = lens[lx];
+            }
+            Vmd5 = k->tab[Sublen];
+            Vmd5x = k->gather;
+            Lanes = kernel_lanes(k, Sublen);
+            nhash = count_substrings();
+            if (nhash == 0) {
+                continue;   // longer than any line
+            }
+            for (Nthread = 1; ; Nthread *= 2) {
+                if (Nthread > maxthread) {
+                    Nthread = maxthread;
+                }
+                clock_gettime(CLOCK_MONOTONIC, &t0);
+                run_search();
+                clock_gettime(CLOCK_MONOTONIC, &t1);
+                secs = (t1.tv_sec - t0.tv_sec) + ((t1.tv_nsec - t0.tv_nsec) / 1e9);
+                printf("%-7s %6d %7d %8.3f %9.1f\n", k->name, Sublen, Nthread, secs,
+                       nhash / secs / 1e6);
+                if (Nthread == maxthread) {
+                    break;
+                }
+            }
+        }
+    }
+    return(0);
+}
+
+
+/*
+ * profile_path() : put the name of this host's profile in 'path',
+ * which has room for MAXNAMELEN characters.
+ */
+void profile_path(char *path)
+{
+    char         *home;        // the directory it goes in
+    char          host[256];   // this host's name
+
+    home = getenv("HOME");
+    if ((home == NULL) || (home[0] == (char) 0)) {
+        home = "/tmp";
+    }
+    if (gethostname(host, sizeof(host)) != 0) {
+        strcpy(host, "localhost");
+    }
+    host[sizeof(host) - 1] = (char) 0;
+    snprintf(path, MAXNAMELEN, PROFILEFMT, home, host);
+}
+
+
+/*
+ * load_profile() : apply the settings -T saved for Hash on this host.
+ * The kernel replaces *kname if that is NULL and this cpu can run it,
+ * the thread count and pinning are used if Nthread is 0, and the chunk
+ * size is used unless we are part of a coordinated search, where every
+ * process must cut the data set the same way.  Each line of the
+ * profile is
+ *    <hash> <kernel> <threads> <pin> <chunk size>
+ */
+void load_profile(char **kname)
+{
+    static char   kernel[16];  // the profile's kernel for Hash, kept for *kname
+    char          path[MAXNAMELEN]; // the profile
+    char          line[MAXDIGLINE]; // a line of it
+    char          hname[16];   // the hash a line is for
+    char          kname1[16];  // and its kernel
+    FILE         *fp;          // the open profile
+    int           threads;     // the line's thread count
+    int           pin;         // whether it pins them
+    int           chunk;       // and its chunk size
+    int           k;           // index into Hash->kernels
+
+    profile_path(path);
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        return;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if ((sscanf(line, "%15s %15s %d %d %d", hname, kname1, &threads, &pin, &chunk) != 5) ||
+            (strcmp(hname, Hash->name) != 0)) {
+            continue;
+        }
+        for (k = 0; k < NKERNELS; k++) {
+            if ((*kname == NULL) && (strcmp(kname1, Hash->kernels[k].name) == 0) &&
+                cpu_has(&Hash->kernels[k])) {
+                strcpy(kernel, kname1);
+                *kname = kernel;
+            }
+        }
+        if ((Nthread == 0) && (threads > 0) && (threads < MXTHRD)) {
+            Nthread = threads;
+            if ((pin > Pin) && (pin <= 2)) {
+                Pin = pin;
+            }
+        }
+        if ((Coordport == NULL) && (Coordinator == NULL) &&
+            (chunk >= MINCHUNK) && (chunk <= MAXCHUNK)) {
+            Chunksz = chunk;
+        }
+    }
+    fclose(fp);
+}
+
+
+/*
+ * save_profile() : record in this host's profile that 'kernel' with
+ * 'threads' threads, pinned if 'pin' (one per core if it is 2), and chunks of 'chunk' substrings
+ * search fastest for Hash.  The lines for the other hashes are kept.
+ * The new profile is written beside the old one and renamed over it.
+ */
+void save_profile(const char *kernel, int threads, int pin, int chunk)
+{
+    char          path[MAXNAMELEN]; // the profile
+    char          tmp[MAXNAMELEN + 16]; // the new one while it is written
+    char          line[MAXDIGLINE]; // a line of the old one
+    char          hname[16];   // the hash a line is for
+    FILE         *in;          // the old profile
+    FILE         *out;         // the new one
+
+    profile_path(path);
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int) getpid());
+    out = fopen(tmp, "w");
+    if (out == NULL) {
+        printf("Unable to write %s\n", tmp);
+        perror(NULL);
+        exit(1);
+    }
+    in = fopen(path, "r");
+    while ((in != NULL) && (fgets(line, sizeof(line), in) != NULL)) {
+        if ((sscanf(line, "%15s", hname) == 1) && (strcmp(hname, Hash->name) == 0)) {
+            continue;
+        }
+        fputs(line, out);
+    }
+    if (in != NULL) {
+        fclose(in);
+    }
+    fprintf(out, "%s %s %d %d %d\n", Hash->name, kernel, threads, pin, chunk);
+    if ((fclose(out) != 0) || (rename(tmp, path) != 0)) {
+        printf("Unable to write %s\n", path);
+        perror(NULL);
+        (void) unlink(tmp);
+        exit(1);
+    }
+    printf("Saved in %s\n", path);
+}
+
+
+/*
+ * tune_trial() : search the data set with the current kernel, threads
+ * and chunk size over and over until TUNESECS have gone by, and return
+ * the rate in millions of hashes a second.
+ */
+double tune_trial()
+{
+    struct timespec t0, t1;    // start and end of the trial
+    double        secs;        // how long it has taken so far
+    long          nhash;       // sums done so far
+    int           i;           // thread index
+
+    place_threads();
+    nhash = 0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    do {
+        run_search();
+        for (i = 0; i < Nthread; i++) {
+            nhash += Slots[i].hashed;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        secs = (t1.tv_sec - t0.tv_sec) + ((t1.tv_nsec - t0.tv_nsec) / 1e9);
+    } while (secs < TUNESECS);
+    return(nhash / secs / 1e6);
+}
+
+
+/*
+ * run_tune() : find the fastest settings for searching /gutenberg for
+ * Sublen character substrings on this host, and save them in its
+ * profile for later runs to use.  Trials on the first TUNEMB megabytes
+ * pick the kernel with 'maxthread' threads, then the number of threads
+ * up to 'maxthread' and whether to pin them, and last the chunk size.
+ * The thread counts tried are the powers of two, one per cpu and one
+ * per core, which is also tried pinned to the first cpu of each core
+ * so the SMT siblings are left idle.  With -p every trial pins the
+ * threads, and with -S the trials search the same share of the
+ * interleaved copy, as the searches that use it will.  Return 0.
+ */
+int run_tune(int maxthread)
+{
+    static const int chunks[] = { 64 * 1024, 256 * 1024, 1024 * 1024 };
+    struct vkernel *k;         // the kernels being tried
+    struct vkernel *bestk;     // the fastest so far
+    int           bestthr;     // and its thread count
+    int           bestpin;     // whether it pins the threads
+    int           bestchunk;   // and its chunk size
+    double        best;        // its rate
+    double        rate;        // the rate of a trial
+    int           kx;          // index into Hash->kernels
+    int           cx;          // index into chunks
+    int           thr;         // thread count being tried
+    int           pinned;      // -p was given, so always pin
+    int           pin;         // whether the trial pins the threads
+    int           maxpin;      // and the value of pin to stop at
+    int           thrs[16];    // thread counts to try, in order
+    int           nthr;        // how many there are
+    int           ncpu;        // cpus we may run on
+    int           ncore;       // and the cores they make up
+    int           i, j;        // generic loop index
+
+    pinned = Pin;
+    if (Datalen > (long) TUNEMB * 1024 * 1024) {
+        Datalen = TUNEMB * 1024 * 1024;
+    }
+    printf("Tuning on %.1f MB of %s for length %d\n", Datalen / (1024.0 * 1024.0),
+           ((Soa != NULL) && (Kern->soa != NULL) && (Sublen <= MAXONEBLK)) ? SOASHM : "/gutenberg",
+           Sublen);
+    printf("kernel  threads pin    chunk   Mhash/s\n");
+    bestk = NULL;
+    bestthr = maxthread;
+    bestpin = pinned;
+    bestchunk = CHUNKSZ;
+    best = 0;
+
+    /* The kernel, with every thread */
+    for (kx = 0; kx < NKERNELS; kx++) {
+        k = &Hash->kernels[kx];
+        if (!cpu_has(k)) {
+            continue;
+        }
+        Kern = k;
+        Vmd5 = k->tab[Sublen];
+        Vmd5x = k->gather;
+        Lanes = kernel_lanes(k, Sublen);
+        Nthread = maxthread;
+        Pin = pinned;
+        Chunksz = CHUNKSZ;
+        rate = tune_trial();
+        printf("%-7s %7d %3d %8d %9.1f\n", k->name, Nthread, Pin, Chunksz, rate);
+        if (rate > best) {
+            best = rate;
+            bestk = k;
+        }
+    }
+    Kern = bestk;
+    Vmd5 = bestk->tab[Sublen];
+    Vmd5x = bestk->gather;
+    Lanes = kernel_lanes(bestk, Sublen);
+
+    /* The number of threads, pinned or not */
+    ncpu = 0;
+    ncore = 0;
+    for (i = 0; i < Nnodes; i++) {
+        ncpu += Nodes[i].ncpu;
+        ncore += Nodes[i].ncore;
+    }
+    nthr = 0;
+    for (thr = 1; thr < maxthread; thr *= 2) {
+        thrs[nthr++] = thr;
+    }
+    thrs[nthr++] = maxthread;
+    for (i = 0; i < 2; i++) {
+        thr = (i == 0) ? ncore : ncpu;
+        for (j = 0; (j < nthr) && (thrs[j] < thr); j++)
+            ;
+        if ((thr < maxthread) && (thrs[j] != thr)) {
+            memmove(&thrs[j + 1], &thrs[j], (nthr - j) * sizeof(int));
+            thrs[j] = thr;
+            nthr++;
+        }
+    }
+    for (i = 0; i < nthr; i++) {
+        thr = thrs[i];
+        maxpin = ((thr == ncore) && (ncore < ncpu)) ? 2 : 1;
+        for (pin = pinned; pin <= maxpin; pin++) {
+            Nthread = thr;
+            Pin = pin;
+            rate = tune_trial();
+            printf("%-7s %7d %3d %8d %9.1f\n", bestk->name, Nthread, Pin, Chunksz, rate);
+            if (rate > best) {
+                best = rate;
+                bestthr = Nthread;
+                bestpin = Pin;
+            }
+        }
+    }
+    Nthread = bestthr;
+    Pin = bestpin;
+
+    /* The size of a chunk */
+    for (cx = 0; cx < (int) (sizeof(chunks) / sizeof(chunks[0])); cx++) {
+        if (chunks[cx] == CHUNKSZ) {
+            continue;
+        }
+        Chunksz = chunks[cx];
+        rate = tune_trial();
+        printf("%-7s %7d %3d %8d %9.1f\n", bestk->name, Nthread, Pin, Chunksz, rate);
+        if (rate > best) {
+            best = rate;
+            bestchunk = Chunksz;
+        }
+    }
+
+    printf("Best: %s kernel, %d threads%s, chunks of %d, %.1f Mhash/s\n", bestk->name,
+           bestthr, (bestpin == 2) ? " pinned one per core" : (bestpin ? " pinned" : ""),
+           bestchunk, best);
+    save_profile(bestk->name, bestthr, bestpin, bestchunk);
+    return(0);
+}
@@ -0,0 +1,676 @@
+/*
+ * This file holds the MD5 kernels for one vector width.  It is
+ * included by shm_vec_md5.c once for each instruction set we
+ * support, with these defined:
+ *    VL        the number of 32 bit lanes: 1, 4, 8 or 16
+ *    VSETS     the number of sets of VL lanes the one block kernels
+ *              hash together, at most MAXSETS
+ *    VNAME(n)  the name n with the instruction set appended
+ * The includer provides the F, G, H, I, ROTATE and R0-R3 macros
+ * (and may point them at native instructions), VMASK(v) to turn a
+ * vector compare into a bitmask of lanes, VLOADW(p) which returns a
+ * vector whose lane i is the 32 bit word at p + i, VGATHERW(p, off)
+ * which returns a vector whose lane i is the 32 bit word at
+ * p + off[i], MAXSUBLEN, MAXONEBLK, MAXSETS, SOAPOS(), the targetset
+ * struct and the vmd5fn, vmd5xfn and vsoafn types.  The result is the
+ * table VNAME(Vmd5tab) of kernels indexed by substring length and the
+ * kernel VNAME(vmd5_gather) for substrings at any offsets, and for
+ * the vector widths that divide SOASTREAMS into at most MAXSETS sets
+ * the table VNAME(Vsoatab) of one block kernels for the interleaved
+ * copy of the data set.  VL and VNAME are left defined for
+ * vsha_kernel.h, which uses the vector types and loaders here.
+ */
+
+
+    /* vector definition for VL unsigned ints */
+#if VL == 1
+typedef uint32_t VNAME(vecui);
+#else
+typedef uint32_t VNAME(vecui) __attribute__ ((vector_size (4 * VL)));
+#endif
+
+union VNAME(vui) {
+    VNAME(vecui) v;       // vector
+    uint32_t     s[VL];   // scalar equivalent
+};
+
+
+/*
+ * Load the VL messages that start at data[0] through data[VL-1] into
+ * X and add the MD5 end of message bit.  Word j of the VL messages is
+ * built by VLOADW() from one short load of the bytes at data + 4j
+ * that all of the lanes share, instead of VL separate loads.  Only
+ * the words that hold the string are loaded; msgw() supplies the
+ * rest of the blocks.  Meant to be inlined with 'sublen' a constant
+ * so the masks below are known at compile time.
+ */
+static inline __attribute__((always_inline))
+void VNAME(load_msg)(union VNAME(vui) X[], const char *data, const int sublen)
+{
+    int           j;           // generic loop index
+    VNAME(vecui)  zero = { 0 };
+    uint32_t      maskor;      // mask onto end of string
+    uint32_t      maskand;     // mask from end of string
+
+    // compute end of messsage bit
+    if (sublen % 4 == 3) {
+        maskand = 0x00FFFFFF;
+        maskor = 0x80000000;
+    }
+    else if (sublen % 4 == 2) {
+        maskand = 0x0000FFFF;
+        maskor = 0x00800000;
+    }
+    else if (sublen % 4 == 1) {
+        maskand = 0x000000FF;
+        maskor = 0x00008000;
+    }
+    else {
+        maskand = 0x00000000;
+        maskor = 0x00000080;
+    }
+
+    for (j = 0; j < (sublen / sizeof(uint32_t)); j++) {
+        X[j].v = VLOADW(data + (j * 4));
+    }
+    if (maskand == 0) {
+        X[j].v = zero + maskor;
+    }
+    else {
+        X[j].v = (VLOADW(data + (j * 4)) & maskand) | maskor;
+    }
+}
+
+
+/*
+ * Load the padded messages that start at data[0] through data[VL-1],
+ * or at data[off[0]] through data[off[VL-1]] if 'off' is not NULL,
+ * into X.  This is the run time length version of load_msg(): every
+ * word of the one or two blocks is filled in, including the end of
+ * message bit and the length.
+ */
+static inline __attribute__((always_inline))
+void VNAME(load_padded)(union VNAME(vui) X[], const char *data, const int32_t off[], int sublen)
+{
+    int           j;           // generic loop index
+    int           nw;          // words in the padded message
+    VNAME(vecui)  zero = { 0 };
+    uint32_t      maskor;      // mask onto end of string
+    uint32_t      maskand;     // mask from end of string
+
+    // the same end of message masks as load_msg()
+    maskand = (sublen % 4 == 0) ? 0 : (0xFFFFFFFF >> (8 * (4 - (sublen % 4))));
+    maskor = 0x00000080 << (8 * (sublen % 4));
+    nw = (sublen > MAXONEBLK) ? (2 * 16) : 16;
+
+    for (j = 0; j < (sublen / 4); j++) {
+        X[j].v = (off == NULL) ? VLOADW(data + (j * 4)) : VGATHERW(data + (j * 4), off);
+    }
+    if (maskand == 0) {
+        X[j].v = zero | maskor;
+    }
+    else {
+        X[j].v = (((off == NULL) ? VLOADW(data + (j * 4)) : VGATHERW(data + (j * 4), off))
+                  & maskand) | maskor;
+    }
+    for (j = j + 1; j < nw; j++) {
+        X[j].v = zero;
+    }
+    X[nw - 2].v = zero + (uint32_t) (sublen * 8);
+}
+
+
+/*
+ * Return word j of block 'blk' of the padded message in X.  A sublen
+ * of 0 means X holds the whole padded message, as filled in by
+ * load_padded().  Otherwise X holds the string words of a one block
+ * sublen character message from load_msg(); with sublen a constant
+ * the words past the end of the string are known to be zero and the
+ * length word X[14] a constant, and both fold into the round
+ * constants.
+ */
+static inline __attribute__((always_inline))
+VNAME(vecui) VNAME(msgw)(union VNAME(vui) X[], const int blk, const int j, const int sublen)
+{
+    VNAME(vecui)  zero = { 0 };
+
+    if (sublen == 0) {
+        return(X[blk * 16 + j].v);
+    }
+    if (j == 14) {
+        return(zero + (uint32_t) (sublen * 8));
+    }
+    if ((blk * 16 + j) > (sublen / 4)) {
+        return(zero);
+    }
+    return(X[blk * 16 + j].v);
+}
+
+
+/*
+ * Return a bitmask of the lanes whose A word could belong to one of
+ * the targets in 't'.  A is the state before the final add of a0, so
+ * a single target is one vector compare against target.i[0] - a0.
+ * Several targets are checked lane by lane in the prefilter bitmap.
+ * In a prefix search only the masked bits of A are compared.
+ */
+static inline __attribute__((always_inline))
+uint32_t VNAME(check_a)(VNAME(vecui) A, VNAME(vecui) a0, const struct targetset *t)
+{
+    VNAME(vecui) zero = { 0 };
+    union VNAME(vui) sum;      // the final A words
+    uint32_t      mask;        // lanes that pass
+    uint32_t      key;         // bitmap index of a lane
+    int           i;           // generic loop index
+
+    if (t->mask != NULL) {
+        return(VMASK(((A + a0) & (zero + t->mask->i[0])) == (zero + t->sums[0].i[0])));
+    }
+    if (t->count == 1) {
+        return(VMASK(A == (zero + t->sums[0].i[0]) - a0));
+    }
+    sum.v = A + a0;
+    mask = 0;
+    for (i = 0; i < VL; i++) {
+        key = sum.s[i] & t->bmask;
+        mask |= (uint32_t) ((t->bitmap[key >> 6] >> (key & 63)) & 1) << i;
+    }
+    return(mask);
+}
+
+
+    /* Do one MD5 step on each of the ns sets of lanes.  Putting the
+     * sets' steps next to each other lets the cpu overlap them. */
+#define STEP(R, a, b, c, d, k, s, t) \
+        _Pragma("GCC unroll 4") \
+        for (n = 0; n < ns; n++) \
+            R(a[n], b[n], c[n], d[n], VNAME(msgw)(X[n], blk, (k), sublen), s, t)
+
+
+/*
+ * Do MD5 steps 1 to 61 of block 'blk' on ns sets of VL lanes.
+ * After step 61 A has its final value.
+ */
+static inline __attribute__((always_inline))
+void VNAME(md5_61)(VNAME(vecui) A[], VNAME(vecui) B[], VNAME(vecui) C[], VNAME(vecui) D[],
+                   union VNAME(vui) X[][2 * 16], const int blk, const int sublen, const int ns)
+{
+    int           n;           // lane set index
+
+    /* Round 0 */
+    STEP(R0, A, B, C, D, 0, 7, 0xd76aa478);
+    STEP(R0, D, A, B, C, 1, 12, 0xe8c7b756);
+    STEP(R0, C, D, A, B, 2, 17, 0x242070db);
+    STEP(R0, B, C, D, A, 3, 22, 0xc1bdceee);
+    STEP(R0, A, B, C, D, 4, 7, 0xf57c0faf);
+    STEP(R0, D, A, B, C, 5, 12, 0x4787c62a);
+    STEP(R0, C, D, A, B, 6, 17, 0xa8304613);
+    STEP(R0, B, C, D, A, 7, 22, 0xfd469501);
+    STEP(R0, A, B, C, D, 8, 7, 0x698098d8);
+    STEP(R0, D, A, B, C, 9, 12, 0x8b44f7af);
+    STEP(R0, C, D, A, B, 10, 17, 0xffff5bb1);
+    STEP(R0, B, C, D, A, 11, 22, 0x895cd7be);
+    STEP(R0, A, B, C, D, 12, 7, 0x6b901122);
+    STEP(R0, D, A, B, C, 13, 12, 0xfd987193);
+    STEP(R0, C, D, A, B, 14, 17, 0xa679438e);
+    STEP(R0, B, C, D, A, 15, 22, 0x49b40821);
+    /* Round 1 */
+    STEP(R1, A, B, C, D, 1, 5, 0xf61e2562);
+    STEP(R1, D, A, B, C, 6, 9, 0xc040b340);
+    STEP(R1, C, D, A, B, 11, 14, 0x265e5a51);
+    STEP(R1, B, C, D, A, 0, 20, 0xe9b6c7aa);
+    STEP(R1, A, B, C, D, 5, 5, 0xd62f105d);
+    STEP(R1, D, A, B, C, 10, 9, 0x02441453);
+    STEP(R1, C, D, A, B, 15, 14, 0xd8a1e681);
+    STEP(R1, B, C, D, A, 4, 20, 0xe7d3fbc8);
+    STEP(R1, A, B, C, D, 9, 5, 0x21e1cde6);
+    STEP(R1, D, A, B, C, 14, 9, 0xc33707d6);
+    STEP(R1, C, D, A, B, 3, 14, 0xf4d50d87);
+    STEP(R1, B, C, D, A, 8, 20, 0x455a14ed);
+    STEP(R1, A, B, C, D, 13, 5, 0xa9e3e905);
+    STEP(R1, D, A, B, C, 2, 9, 0xfcefa3f8);
+    STEP(R1, C, D, A, B, 7, 14, 0x676f02d9);
+    STEP(R1, B, C, D, A, 12, 20, 0x8d2a4c8a);
+    /* Round 2 */
+    STEP(R2, A, B, C, D, 5, 4, 0xfffa3942);
+    STEP(R2, D, A, B, C, 8, 11, 0x8771f681);
+    STEP(R2, C, D, A, B, 11, 16, 0x6d9d6122);
+    STEP(R2, B, C, D, A, 14, 23, 0xfde5380c);
+    STEP(R2, A, B, C, D, 1, 4, 0xa4beea44);
+    STEP(R2, D, A, B, C, 4, 11, 0x4bdecfa9);
+    STEP(R2, C, D, A, B, 7, 16, 0xf6bb4b60);
+    STEP(R2, B, C, D, A, 10, 23, 0xbebfbc70);
+    STEP(R2, A, B, C, D, 13, 4, 0x289b7ec6);
+    STEP(R2, D, A, B, C, 0, 11, 0xeaa127fa);
+    STEP(R2, C, D, A, B, 3, 16, 0xd4ef3085);
+    STEP(R2, B, C, D, A, 6, 23, 0x04881d05);
+    STEP(R2, A, B, C, D, 9, 4, 0xd9d4d039);
+    STEP(R2, D, A, B, C, 12, 11, 0xe6db99e5);
+    STEP(R2, C, D, A, B, 15, 16, 0x1fa27cf8);
+    STEP(R2, B, C, D, A, 2, 23, 0xc4ac5665);
+    /* Round 3 */
+    STEP(R3, A, B, C, D, 0, 6, 0xf4292244);
+    STEP(R3, D, A, B, C, 7, 10, 0x432aff97);
+    STEP(R3, C, D, A, B, 14, 15, 0xab9423a7);
+    STEP(R3, B, C, D, A, 5, 21, 0xfc93a039);
+    STEP(R3, A, B, C, D, 12, 6, 0x655b59c3);
+    STEP(R3, D, A, B, C, 3, 10, 0x8f0ccc92);
+    STEP(R3, C, D, A, B, 10, 15, 0xffeff47d);
+    STEP(R3, B, C, D, A, 1, 21, 0x85845dd1);
+    STEP(R3, A, B, C, D, 8, 6, 0x6fa87e4f);
+    STEP(R3, D, A, B, C, 15, 10, 0xfe2ce6e0);
+    STEP(R3, C, D, A, B, 6, 15, 0xa3014314);
+    STEP(R3, B, C, D, A, 13, 21, 0x4e0811a1);
+    STEP(R3, A, B, C, D, 4, 6, 0xf7537e82);
+}
+
+
+/*
+ * Do MD5 steps 62 to 64 of block 'blk' on ns sets of VL lanes.
+ */
+static inline __attribute__((always_inline))
+void VNAME(md5_last3)(VNAME(vecui) A[], VNAME(vecui) B[], VNAME(vecui) C[], VNAME(vecui) D[],
+                      union VNAME(vui) X[][2 * 16], const int blk, const int sublen, const int ns)
+{
+    int           n;           // lane set index
+
+    STEP(R3, D, A, B, C, 11, 10, 0xbd3af235);
+    STEP(R3, C, D, A, B, 2, 15, 0x2ad7d2bb);
+    STEP(R3, B, C, D, A, 9, 21, 0xeb86d391);
+}
+#undef STEP
+
+
+/*
+ * Finish the last block of ns sets of lanes.  A is final after step
+ * 61, so the lanes are checked against the targets there and if none
+ * can match we return 0 without doing the last three steps.
+ * Otherwise the sums are returned in H[0..4*ns*VL-1], which holds the
+ * A words of the lanes followed by the B, C and D words, and the
+ * return value is the bitmask of lanes that passed the check.
+ */
+static inline __attribute__((always_inline))
+uint32_t VNAME(md5_finish)(VNAME(vecui) A[], VNAME(vecui) B[], VNAME(vecui) C[], VNAME(vecui) D[],
+                           VNAME(vecui) a0[], VNAME(vecui) b0[], VNAME(vecui) c0[], VNAME(vecui) d0[],
+                           union VNAME(vui) X[][2 * 16], const int blk, const int sublen,
+                           const int ns, uint32_t H[], const struct targetset *t)
+{
+    uint32_t     mask;        // lanes that pass the A check
+    int          n;           // lane set index
+
+    /* A is final.  Nearly every lane is a miss, skip the rest. */
+    mask = 0;
+    for (n = 0; n < ns; n++) {
+        mask |= VNAME(check_a)(A[n], a0[n], t) << (n * VL);
+    }
+    if (mask == 0) {
+        return(0);
+    }
+    VNAME(md5_last3)(A, B, C, D, X, blk, sublen, ns);
+
+    //Add this chunk's hash to result so far:
+    for (n = 0; n < ns; n++) {
+        A[n] = A[n] + a0[n];
+        B[n] = B[n] + b0[n];
+        C[n] = C[n] + c0[n];
+        D[n] = D[n] + d0[n];
+        memcpy(H + ((0 * ns + n) * VL), &A[n], sizeof(A[n]));
+        memcpy(H + ((1 * ns + n) * VL), &B[n], sizeof(B[n]));
+        memcpy(H + ((2 * ns + n) * VL), &C[n], sizeof(C[n]));
+        memcpy(H + ((3 * ns + n) * VL), &D[n], sizeof(D[n]));
+    }
+    return(mask);
+}
+
+
+/*
+ * Compute the MD5 sums of the ns * VL substrings that start at
+ * data[0] through data[ns * VL - 1], for substrings that fit in one
+ * block.  See md5_finish() for what is returned.  Meant to be inlined
+ * with 'sublen' and 'ns' constants.
+ */
+static inline __attribute__((always_inline))
+uint32_t VNAME(vmd5_body)(const char *data, uint32_t H[], const struct targetset *t,
+                          const int sublen, const int ns)
+{
+    VNAME(vecui) zero = { 0 };
+    union VNAME(vui) X[MAXSETS][2 * 16]; // string words of each set of lanes
+    int          n;           // lane set index
+    // md5 state for a given chuck
+    VNAME(vecui) A[MAXSETS];
+    VNAME(vecui) B[MAXSETS];
+    VNAME(vecui) C[MAXSETS];
+    VNAME(vecui) D[MAXSETS];
+    VNAME(vecui) a0[MAXSETS];
+    VNAME(vecui) b0[MAXSETS];
+    VNAME(vecui) c0[MAXSETS];
+    VNAME(vecui) d0[MAXSETS];
+
+    //Initialize variables:
+    for (n = 0; n < ns; n++) {
+        VNAME(load_msg)(X[n], data + (n * VL), sublen);
+        A[n] = a0[n] = zero + 0x67452301;
+        B[n] = b0[n] = zero + 0xefcdab89;
+        C[n] = c0[n] = zero + 0x98badcfe;
+        D[n] = d0[n] = zero + 0x10325476;
+    }
+
+    VNAME(md5_61)(A, B, C, D, X, 0, sublen, ns);
+    return(VNAME(md5_finish)(A, B, C, D, a0, b0, c0, d0, X, 0, sublen, ns, H, t));
+}
+
+
+/*
+ * Compute the MD5 sums of the 2 * VL substrings that start at data[0]
+ * through data[2 * VL - 1], for substrings that need two blocks.  The
+ * first block's chaining values feed the second.  The two sets of
+ * lanes are hashed together so each set's steps overlap with the
+ * other's.  There is one copy of this for all of the two block
+ * lengths, so 'sublen' is not a constant here; the first block is
+ * all string for most of these lengths anyway.  See md5_finish() for
+ * what is returned.
+ */
+static __attribute__((noinline))
+uint32_t VNAME(vmd5_2blk)(const char *data, uint32_t H[], const struct targetset *t,
+                          int sublen)
+{
+    VNAME(vecui) zero = { 0 };
+    union VNAME(vui) X[2][2 * 16]; // padded message words of each set of lanes
+    int          n;           // lane set index
+    // md5 state for a given chuck
+    VNAME(vecui) A[2];
+    VNAME(vecui) B[2];
+    VNAME(vecui) C[2];
+    VNAME(vecui) D[2];
+    VNAME(vecui) a0[2];
+    VNAME(vecui) b0[2];
+    VNAME(vecui) c0[2];
+    VNAME(vecui) d0[2];
+
+    //Initialize variables:
+    for (n = 0; n < 2; n++) {
+        VNAME(load_padded)(X[n], data + (n * VL), NULL, sublen);
+        A[n] = a0[n] = zero + 0x67452301;
+        B[n] = b0[n] = zero + 0xefcdab89;
+        C[n] = c0[n] = zero + 0x98badcfe;
+        D[n] = d0[n] = zero + 0x10325476;
+    }
+
+    /* The first block: all 64 steps, then chain */
+    VNAME(md5_61)(A, B, C, D, X, 0, 0, 2);
+    VNAME(md5_last3)(A, B, C, D, X, 0, 0, 2);
+    for (n = 0; n < 2; n++) {
+        A[n] = a0[n] = A[n] + a0[n];
+        B[n] = b0[n] = B[n] + b0[n];
+        C[n] = c0[n] = C[n] + c0[n];
+        D[n] = d0[n] = D[n] + d0[n];
+    }
+
+    VNAME(md5_61)(A, B, C, D, X, 1, 0, 2);
+    return(VNAME(md5_finish)(A, B, C, D, a0, b0, c0, d0, X, 1, 0, 2, H, t));
+}
+
+
+/*
+ * Compute the MD5 sums of the ns * VL substrings that start at
+ * data[off[0]] through data[off[ns * VL - 1]], with one or two
+ * blocks as 'sublen' needs.  See md5_finish() for what is returned.
+ * Meant to be inlined with 'ns' a constant.
+ */
+static inline __attribute__((always_inline))
+uint32_t VNAME(vmd5_gbody)(const char *data, const int32_t off[], uint32_t H[],
+                           const struct targetset *t, int sublen, const int ns)
+{
+    VNAME(vecui) zero = { 0 };
+    union VNAME(vui) X[MAXSETS][2 * 16]; // padded message words of each set of lanes
+    int          n;           // lane set index
+    // md5 state for a given chuck
+    VNAME(vecui) A[MAXSETS];
+    VNAME(vecui) B[MAXSETS];
+    VNAME(vecui) C[MAXSETS];
+    VNAME(vecui) D[MAXSETS];
+    VNAME(vecui) a0[MAXSETS];
+    VNAME(vecui) b0[MAXSETS];
+    VNAME(vecui) c0[MAXSETS];
+    VNAME(vecui) d0[MAXSETS];
+
+    //Initialize variables:
+    for (n = 0; n < ns; n++) {
+        VNAME(load_padded)(X[n], data, off + (n * VL), sublen);
+        A[n] = a0[n] = zero + 0x67452301;
+        B[n] = b0[n] = zero + 0xefcdab89;
+        C[n] = c0[n] = zero + 0x98badcfe;
+        D[n] = d0[n] = zero + 0x10325476;
+    }
+
+    VNAME(md5_61)(A, B, C, D, X, 0, 0, ns);
+    if (sublen <= MAXONEBLK) {
+        return(VNAME(md5_finish)(A, B, C, D, a0, b0, c0, d0, X, 0, 0, ns, H, t));
+    }
+
+    /* Finish the first block and chain into the second */
+    VNAME(md5_last3)(A, B, C, D, X, 0, 0, ns);
+    for (n = 0; n < ns; n++) {
+        A[n] = a0[n] = A[n] + a0[n];
+        B[n] = b0[n] = B[n] + b0[n];
+        C[n] = c0[n] = C[n] + c0[n];
+        D[n] = d0[n] = D[n] + d0[n];
+    }
+    VNAME(md5_61)(A, B, C, D, X, 1, 0, ns);
+    return(VNAME(md5_finish)(A, B, C, D, a0, b0, c0, d0, X, 1, 0, ns, H, t));
+}
+
+
+/*
+ * Compute the MD5 sums of substrings at the offsets off[] from data,
+ * as many as the vmd5_<sublen> kernel does in one call: VSETS * VL of
+ * them, or 2 * VL for two block substrings.  This takes the substrings that
+ * do not make up a whole call's worth of consecutive offsets, so it
+ * is only one kernel with a run time length.
+ */
+static __attribute__((noinline))
+uint32_t VNAME(vmd5_gather)(const char *data, const int32_t off[], uint32_t H[],
+                            const struct targetset *t, int sublen)
+{
+    if (sublen > MAXONEBLK) {
+        return(VNAME(vmd5_gbody)(data, off, H, t, sublen, 2));
+    }
+    return(VNAME(vmd5_gbody)(data, off, H, t, sublen, VSETS));
+}
+
+
+    /* One kernel for each substring length, with the length a constant.
+     * The one block lengths hash VSETS sets of lanes per call, so that
+     * the steps of one set fill the latency of the others' add and
+     * rotate chains.  The two block lengths share vmd5_2blk(). */
+#define VMD5_LEN(n) \
+static uint32_t VNAME(vmd5_##n)(const char *data, uint32_t H[], \
+                                const struct targetset *t) \
+{ \
+    if ((n) > MAXONEBLK) \
+        return(VNAME(vmd5_2blk)(data, H, t, n)); \
+    return(VNAME(vmd5_body)(data, H, t, n, VSETS)); \
+}
+
+VMD5_LEN(19) VMD5_LEN(20) VMD5_LEN(21) VMD5_LEN(22) VMD5_LEN(23)
+VMD5_LEN(24) VMD5_LEN(25) VMD5_LEN(26) VMD5_LEN(27) VMD5_LEN(28)
+VMD5_LEN(29) VMD5_LEN(30) VMD5_LEN(31) VMD5_LEN(32) VMD5_LEN(33)
+VMD5_LEN(34) VMD5_LEN(35) VMD5_LEN(36) VMD5_LEN(37) VMD5_LEN(38)
+VMD5_LEN(39) VMD5_LEN(40) VMD5_LEN(41) VMD5_LEN(42) VMD5_LEN(43)
+VMD5_LEN(44) VMD5_LEN(45) VMD5_LEN(46) VMD5_LEN(47) VMD5_LEN(48)
+VMD5_LEN(49) VMD5_LEN(50) VMD5_LEN(51) VMD5_LEN(52) VMD5_LEN(53)
+VMD5_LEN(54) VMD5_LEN(55) VMD5_LEN(56) VMD5_LEN(57) VMD5_LEN(58)
+VMD5_LEN(59) VMD5_LEN(60) VMD5_LEN(61) VMD5_LEN(62) VMD5_LEN(63)
+VMD5_LEN(64) VMD5_LEN(65) VMD5_LEN(66) VMD5_LEN(67) VMD5_LEN(68)
+VMD5_LEN(69) VMD5_LEN(70) VMD5_LEN(71) VMD5_LEN(72) VMD5_LEN(73)
+VMD5_LEN(74) VMD5_LEN(75) VMD5_LEN(76) VMD5_LEN(77) VMD5_LEN(78)
+VMD5_LEN(79) VMD5_LEN(80) VMD5_LEN(81) VMD5_LEN(82) VMD5_LEN(83)
+VMD5_LEN(84) VMD5_LEN(85) VMD5_LEN(86) VMD5_LEN(87) VMD5_LEN(88)
+VMD5_LEN(89) VMD5_LEN(90) VMD5_LEN(91) VMD5_LEN(92) VMD5_LEN(93)
+VMD5_LEN(94) VMD5_LEN(95) VMD5_LEN(96) VMD5_LEN(97) VMD5_LEN(98)
+VMD5_LEN(99) VMD5_LEN(100) VMD5_LEN(101) VMD5_LEN(102) VMD5_LEN(103)
+VMD5_LEN(104) VMD5_LEN(105) VMD5_LEN(106) VMD5_LEN(107) VMD5_LEN(108)
+VMD5_LEN(109) VMD5_LEN(110) VMD5_LEN(111) VMD5_LEN(112) VMD5_LEN(113)
+VMD5_LEN(114) VMD5_LEN(115) VMD5_LEN(116) VMD5_LEN(117) VMD5_LEN(118)
+VMD5_LEN(119)
+
+    /* kernels indexed by substring length */
+static vmd5fn VNAME(Vmd5tab)[MAXSUBLEN + 1] = {
+    [19] = VNAME(vmd5_19), [20] = VNAME(vmd5_20), [21] = VNAME(vmd5_21), [22] = VNAME(vmd5_22),
+    [23] = VNAME(vmd5_23), [24] = VNAME(vmd5_24), [25] = VNAME(vmd5_25), [26] = VNAME(vmd5_26),
+    [27] = VNAME(vmd5_27), [28] = VNAME(vmd5_28), [29] = VNAME(vmd5_29), [30] = VNAME(vmd5_30),
+    [31] = VNAME(vmd5_31), [32] = VNAME(vmd5_32), [33] = VNAME(vmd5_33), [34] = VNAME(vmd5_34),
+    [35] = VNAME(vmd5_35), [36] = VNAME(vmd5_36), [37] = VNAME(vmd5_37), [38] = VNAME(vmd5_38),
+    [39] = VNAME(vmd5_39), [40] = VNAME(vmd5_40), [41] = VNAME(vmd5_41), [42] = VNAME(vmd5_42),
+    [43] = VNAME(vmd5_43), [44] = VNAME(vmd5_44), [45] = VNAME(vmd5_45), [46] = VNAME(vmd5_46),
+    [47] = VNAME(vmd5_47), [48] = VNAME(vmd5_48), [49] = VNAME(vmd5_49), [50] = VNAME(vmd5_50),
+    [51] = VNAME(vmd5_51), [52] = VNAME(vmd5_52), [53] = VNAME(vmd5_53), [54] = VNAME(vmd5_54),
+    [55] = VNAME(vmd5_55), [56] = VNAME(vmd5_56), [57] = VNAME(vmd5_57), [58] = VNAME(vmd5_58),
+    [59] = VNAME(vmd5_59), [60] = VNAME(vmd5_60), [61] = VNAME(vmd5_61), [62] = VNAME(vmd5_62),
+    [63] = VNAME(vmd5_63), [64] = VNAME(vmd5_64), [65] = VNAME(vmd5_65), [66] = VNAME(vmd5_66),
+    [67] = VNAME(vmd5_67), [68] = VNAME(vmd5_68), [69] = VNAME(vmd5_69), [70] = VNAME(vmd5_70),
+    [71] = VNAME(vmd5_71), [72] = VNAME(vmd5_72), [73] = VNAME(vmd5_73), [74] = VNAME(vmd5_74),
+    [75] = VNAME(vmd5_75), [76] = VNAME(vmd5_76), [77] = VNAME(vmd5_77), [78] = VNAME(vmd5_78),
+    [79] = VNAME(vmd5_79), [80] = VNAME(vmd5_80), [81] = VNAME(vmd5_81), [82] = VNAME(vmd5_82),
+    [83] = VNAME(vmd5_83), [84] = VNAME(vmd5_84), [85] = VNAME(vmd5_85), [86] = VNAME(vmd5_86),
+    [87] = VNAME(vmd5_87), [88] = VNAME(vmd5_88), [89] = VNAME(vmd5_89), [90] = VNAME(vmd5_90),
+    [91] = VNAME(vmd5_91), [92] = VNAME(vmd5_92), [93] = VNAME(vmd5_93), [94] = VNAME(vmd5_94),
+    [95] = VNAME(vmd5_95), [96] = VNAME(vmd5_96), [97] = VNAME(vmd5_97), [98] = VNAME(vmd5_98),
+    [99] = VNAME(vmd5_99), [100] = VNAME(vmd5_100), [101] = VNAME(vmd5_101), [102] = VNAME(vmd5_102),
+    [103] = VNAME(vmd5_103), [104] = VNAME(vmd5_104), [105] = VNAME(vmd5_105), [106] = VNAME(vmd5_106),
+    [107] = VNAME(vmd5_107), [108] = VNAME(vmd5_108), [109] = VNAME(vmd5_109), [110] = VNAME(vmd5_110),
+    [111] = VNAME(vmd5_111), [112] = VNAME(vmd5_112), [113] = VNAME(vmd5_113), [114] = VNAME(vmd5_114),
+    [115] = VNAME(vmd5_115), [116] = VNAME(vmd5_116), [117] = VNAME(vmd5_117), [118] = VNAME(vmd5_118),
+    [119] = VNAME(vmd5_119),
+};
+
+#undef VMD5_LEN
+
+
+#if (SOASTREAMS / VL) <= MAXSETS
+    /* The interleaved copy holds SOASTREAMS streams side by side, so
+     * VSOAG vectors cover one row of it, and each call hashes VSOAPOS
+     * consecutive positions in every stream. */
+#define VSOAG   (SOASTREAMS / VL)
+#define VSOAPOS SOAPOS(VL, VSETS)
+
+/*
+ * Load the VL messages that start 'shift' bytes into the words at
+ * row[0] through row[VL-1] of the interleaved copy, one per stream,
+ * into X and add the MD5 end of message bit.  Word j of the streams
+ * is at row + j * SOASTREAMS, so each word of the messages is one
+ * aligned load, or two and a shift when the messages do not start on
+ * a word.  Meant to be inlined with 'sublen' a constant.
+ */
+static inline __attribute__((always_inline))
+void VNAME(load_soa)(union VNAME(vui) X[], const uint32_t *row, int shift, const int sublen)
+{
+    int           j;           // generic loop index
+    int           nw;          // words that hold some of the string
+    VNAME(vecui)  lo, hi;      // the rows a word straddles
+    uint32_t      maskor;      // mask onto end of string
+    uint32_t      maskand;     // mask from end of string
+
+    // the same end of message masks as load_msg()
+    maskand = (sublen % 4 == 0) ? 0 : (0xFFFFFFFF >> (8 * (4 - (sublen % 4))));
+    maskor = 0x00000080 << (8 * (sublen % 4));
+    nw = (sublen + 3) / 4;
+
+    if (shift == 0) {
+        for (j = 0; j < nw; j++) {
+            X[j].v = *(const VNAME(vecui) *) (row + (j * SOASTREAMS));
+        }
+    }
+    else {
+        hi = *(const VNAME(vecui) *) row;
+        for (j = 0; j < nw; j++) {
+            lo = hi;
+            hi = *(const VNAME(vecui) *) (row + ((j + 1) * SOASTREAMS));
+            X[j].v = (lo >> (8 * shift)) | (hi << (32 - (8 * shift)));
+        }
+    }
+    if (maskand == 0) {
+        X[nw].v = (VNAME(vecui)) { 0 } + maskor;
+    }
+    else {
+        X[nw - 1].v = (X[nw - 1].v & maskand) | maskor;
+    }
+}
+
+
+/*
+ * Compute the MD5 sums of the substrings that start at byte 'start'
+ * through start + VSOAPOS - 1 of every stream of the interleaved copy
+ * at 'rows', for substrings that fit in one block.  Set n of the
+ * lanes is position n / VSOAG of streams (n % VSOAG) * VL onwards.
+ * See md5_finish() for what is returned.  Meant to be inlined with
+ * 'sublen' a constant.
+ */
+static inline __attribute__((always_inline))
+uint32_t VNAME(vsoa_body)(const uint32_t *rows, long start, uint32_t H[],
+                          const struct targetset *t, const int sublen)
+{
+    VNAME(vecui) zero = { 0 };
+    union VNAME(vui) X[MAXSETS][2 * 16]; // string words of each set of lanes
+    int          n;           // lane set index
+    long         b;           // where set n's substrings start in their streams
+    // md5 state for a given chuck
+    VNAME(vecui) A[MAXSETS];
+    VNAME(vecui) B[MAXSETS];
+    VNAME(vecui) C[MAXSETS];
+    VNAME(vecui) D[MAXSETS];
+    VNAME(vecui) a0[MAXSETS];
+    VNAME(vecui) b0[MAXSETS];
+    VNAME(vecui) c0[MAXSETS];
+    VNAME(vecui) d0[MAXSETS];
+
+    //Initialize variables:
+    for (n = 0; n < VSOAG * VSOAPOS; n++) {
+        b = start + (n / VSOAG);
+        VNAME(load_soa)(X[n], rows + ((b / 4) * SOASTREAMS) + ((n % VSOAG) * VL), b % 4, sublen);
+        A[n] = a0[n] = zero + 0x67452301;
+        B[n] = b0[n] = zero + 0xefcdab89;
+        C[n] = c0[n] = zero + 0x98badcfe;
+        D[n] = d0[n] = zero + 0x10325476;
+    }
+
+    VNAME(md5_61)(A, B, C, D, X, 0, sublen, VSOAG * VSOAPOS);
+    return(VNAME(md5_finish)(A, B, C, D, a0, b0, c0, d0, X, 0, sublen, VSOAG * VSOAPOS, H, t));
+}
+
+
+    /* One kernel for each one block substring length */
+#define VSOA_LEN(n) \
+static uint32_t VNAME(vsoa_##n)(const uint32_t *rows, long start, uint32_t H[], \
+                                const struct targetset *t) \
+{ \
+    return(VNAME(vsoa_body)(rows, start, H, t, n)); \
+}
+
+VSOA_LEN(19) VSOA_LEN(20) VSOA_LEN(21) VSOA_LEN(22) VSOA_LEN(23)
+VSOA_LEN(24) VSOA_LEN(25) VSOA_LEN(26) VSOA_LEN(27) VSOA_LEN(28)
+VSOA_LEN(29) VSOA_LEN(30) VSOA_LEN(31) VSOA_LEN(32) VSOA_LEN(33)
+VSOA_LEN(34) VSOA_LEN(35) VSOA_LEN(36) VSOA_LEN(37) VSOA_LEN(38)
+VSOA_LEN(39) VSOA_LEN(40) VSOA_LEN(41) VSOA_LEN(42) VSOA_LEN(43)
+VSOA_LEN(44) VSOA_LEN(45) VSOA_LEN(46) VSOA_LEN(47) VSOA_LEN(48)
+VSOA_LEN(49) VSOA_LEN(50) VSOA_LEN(51) VSOA_LEN(52) VSOA_LEN(53)
+VSOA_LEN(54) VSOA_LEN(55)
+
+    /* interleaved copy kernels indexed by substring length */
+static vsoafn VNAME(Vsoatab)[MAXSUBLEN + 1] = {
+    [19] = VNAME(vsoa_19), [20] = VNAME(vsoa_20), [21] = VNAME(vsoa_21), [22] = VNAME(vsoa_22),
+    [23] = VNAME(vsoa_23), [24] = VNAME(vsoa_24), [25] = VNAME(vsoa_25), [26] = VNAME(vsoa_26),
+    [27] = VNAME(vsoa_27), [28] = VNAME(vsoa_28), [29] = VNAME(vsoa_29), [30] = VNAME(vsoa_30),
+    [31] = VNAME(vsoa_31), [32] = VNAME(vsoa_32), [33] = VNAME(vsoa_33), [34] = VNAME(vsoa_34),
+    [35] = VNAME(vsoa_35), [36] = VNAME(vsoa_36), [37] = VNAME(vsoa_37), [38] = VNAME(vsoa_38),
+    [39] = VNAME(vsoa_39), [40] = VNAME(vsoa_40), [41] = VNAME(vsoa_41), [42] = VNAME(vsoa_42),
+    [43] = VNAME(vsoa_43), [44] = VNAME(vsoa_44), [45] = VNAME(vsoa_45), [46] = VNAME(vsoa_46),
+    [47] = VNAME(vsoa_47), [48] = VNAME(vsoa_48), [49] = VNAME(vsoa_49), [50] = VNAME(vsoa_50),
+    [51] = VNAME(vsoa_51), [52] = VNAME(vsoa_52), [53] = VNAME(vsoa_53), [54] = VNAME(vsoa_54),
+    [55] = VNAME(vsoa_55),
+};
+
+#undef VSOA_LEN
+#undef VSOAG
+#undef VSOAPOS
+#endif
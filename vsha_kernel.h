@@ -0,0 +1,371 @@
+/*
+ * This file holds the SHA-1 and SHA-256 kernels for one vector width.
+ * It is included by shm_vec_md5.c right after vmd5_kernel.h, with the
+ * same VL and VNAME(n), and uses that file's vector types, its
+ * load_padded() and its check_a().  The includer provides ROTATE(a, s)
+ * and the vmd5fn and vmd5xfn types.  The kernels follow the same
+ * rules as the MD5 ones: VL lanes per call, or 2 * VL for substrings
+ * that need two blocks, and a bitmask of the lanes whose first word
+ * may be a target, with the nwords words of each sum in H.  The
+ * results are the tables VNAME(Vsha1tab) and VNAME(Vsha256tab) and the
+ * gather kernels VNAME(vsha1_gather) and VNAME(vsha256_gather).
+ *
+ * SHA pads the message like MD5 but reads the words of the block big
+ * endian and puts the bit length in the last word.  The sums are not
+ * known until the last round, so there is no early exit.
+ */
+
+
+/*
+ * Load the padded messages that start at data[0] through data[VL-1],
+ * or at data[off[0]] through data[off[VL-1]], into X as SHA wants
+ * them: the words byte swapped and the length in the last word.
+ */
+static inline __attribute__((always_inline))
+void VNAME(load_be)(union VNAME(vui) X[], const char *data, const int32_t off[], int sublen)
+{
+    VNAME(vecui)  zero = { 0 };
+    VNAME(vecui)  x;           // a word to swap
+    int           nw;          // words in the padded message
+    int           j;           // generic loop index
+
+    nw = (sublen > MAXONEBLK) ? (2 * 16) : 16;
+    VNAME(load_padded)(X, data, off, sublen);
+    for (j = 0; j <= sublen / 4; j++) {
+        x = X[j].v;
+        X[j].v = (x << 24) | ((x & 0xff00) << 8) | ((x >> 8) & 0xff00) | (x >> 24);
+    }
+    X[nw - 2].v = zero;
+    X[nw - 1].v = zero + (uint32_t) (sublen * 8);
+}
+
+
+/*
+ * Store the ns sets of sums in S[word][set] to H, each word's lanes
+ * together as md5_finish() does, and return 'mask'.
+ */
+static inline __attribute__((always_inline))
+uint32_t VNAME(sha_store)(VNAME(vecui) S[][MAXSETS], const int nwords, const int ns,
+                          uint32_t H[], uint32_t mask)
+{
+    int          w;           // word index
+    int          n;           // lane set index
+
+    for (w = 0; w < nwords; w++) {
+        for (n = 0; n < ns; n++) {
+            memcpy(H + ((w * ns + n) * VL), &S[w][n], sizeof(S[w][n]));
+        }
+    }
+    return(mask);
+}
+
+
+/*
+ * Compute the SHA-1 sums of ns * VL substrings, at consecutive offsets
+ * from data if 'off' is NULL and at data[off[i]] otherwise.
+ */
+static inline __attribute__((always_inline))
+uint32_t VNAME(vsha1_body)(const char *data, const int32_t off[], uint32_t H[],
+                           const struct targetset *t, int sublen, const int ns)
+{
+    static const uint32_t iv[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+    VNAME(vecui) zero = { 0 };
+    union VNAME(vui) X[MAXSETS][2 * 16]; // padded message words of each set of lanes
+    VNAME(vecui) W[MAXSETS][16]; // the last 16 words of the schedule
+    VNAME(vecui) S[5][MAXSETS]; // chaining values, then the sums
+    VNAME(vecui) a[MAXSETS], b[MAXSETS], c[MAXSETS], d[MAXSETS], e[MAXSETS];
+    VNAME(vecui) f;           // round function
+    VNAME(vecui) tmp;         // new a
+    uint32_t     k;           // round constant
+    uint32_t     mask;        // lanes that pass the check
+    int          nblk;        // blocks in the message
+    int          blk;         // block index
+    int          r;           // round
+    int          n;           // lane set index
+
+    nblk = (sublen > MAXONEBLK) ? 2 : 1;
+    for (n = 0; n < ns; n++) {
+        VNAME(load_be)(X[n], (off == NULL) ? (data + (n * VL)) : data,
+                       (off == NULL) ? NULL : (off + (n * VL)), sublen);
+        for (r = 0; r < 5; r++) {
+            S[r][n] = zero + iv[r];
+        }
+    }
+    for (blk = 0; blk < nblk; blk++) {
+        for (n = 0; n < ns; n++) {
+            a[n] = S[0][n];
+            b[n] = S[1][n];
+            c[n] = S[2][n];
+            d[n] = S[3][n];
+            e[n] = S[4][n];
+        }
+        _Pragma("GCC unroll 80")
+        for (r = 0; r < 80; r++) {
+            k = (r < 20) ? 0x5a827999 : (r < 40) ? 0x6ed9eba1 : (r < 60) ? 0x8f1bbcdc : 0xca62c1d6;
+            _Pragma("GCC unroll 4")
+            for (n = 0; n < ns; n++) {
+                if (r < 16) {
+                    W[n][r] = X[n][blk * 16 + r].v;
+                }
+                else {
+                    tmp = W[n][(r + 13) & 15] ^ W[n][(r + 8) & 15] ^
+                          W[n][(r + 2) & 15] ^ W[n][r & 15];
+                    W[n][r & 15] = ROTATE(tmp, 1);
+                }
+                if (r < 20) {
+                    f = ((c[n] ^ d[n]) & b[n]) ^ d[n];
+                }
+                else if ((r >= 40) && (r < 60)) {
+                    f = (b[n] & c[n]) | ((b[n] | c[n]) & d[n]);
+                }
+                else {
+                    f = b[n] ^ c[n] ^ d[n];
+                }
+                tmp = ROTATE(a[n], 5) + f + e[n] + k + W[n][r & 15];
+                e[n] = d[n];
+                d[n] = c[n];
+                c[n] = ROTATE(b[n], 30);
+                b[n] = a[n];
+                a[n] = tmp;
+            }
+        }
+        if (blk < nblk - 1) {
+            for (n = 0; n < ns; n++) {
+                S[0][n] += a[n];
+                S[1][n] += b[n];
+                S[2][n] += c[n];
+                S[3][n] += d[n];
+                S[4][n] += e[n];
+            }
+        }
+    }
+
+    /* The first word is checked before the rest are added */
+    mask = 0;
+    for (n = 0; n < ns; n++) {
+        mask |= VNAME(check_a)(a[n], S[0][n], t) << (n * VL);
+    }
+    if (mask == 0) {
+        return(0);
+    }
+    for (n = 0; n < ns; n++) {
+        S[0][n] += a[n];
+        S[1][n] += b[n];
+        S[2][n] += c[n];
+        S[3][n] += d[n];
+        S[4][n] += e[n];
+    }
+    return(VNAME(sha_store)(S, 5, ns, H, mask));
+}
+
+
+    /* Working variable i of round r (a is 0, h is 7) of lane set n.
+     * The variables are renamed each round instead of moved. */
+#define SV(i) v[((i) - r) & 7][n]
+
+
+/*
+ * Compute the SHA-256 sums of ns * VL substrings, at consecutive
+ * offsets from data if 'off' is NULL and at data[off[i]] otherwise.
+ */
+static inline __attribute__((always_inline))
+uint32_t VNAME(vsha256_body)(const char *data, const int32_t off[], uint32_t H[],
+                             const struct targetset *t, int sublen, const int ns)
+{
+    static const uint32_t iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    static const uint32_t kt[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+    };
+    VNAME(vecui) zero = { 0 };
+    union VNAME(vui) X[MAXSETS][2 * 16]; // padded message words of each set of lanes
+    VNAME(vecui) W[MAXSETS][16]; // the last 16 words of the schedule
+    VNAME(vecui) S[8][MAXSETS]; // chaining values, then the sums
+    VNAME(vecui) v[8][MAXSETS]; // working variables a to h
+    VNAME(vecui) s0, s1;      // schedule and round sigmas
+    VNAME(vecui) t1, t2;      // round temporaries
+    uint32_t     mask;        // lanes that pass the check
+    int          nblk;        // blocks in the message
+    int          blk;         // block index
+    int          r;           // round
+    int          n;           // lane set index
+    int          w;           // word index
+
+    nblk = (sublen > MAXONEBLK) ? 2 : 1;
+    for (n = 0; n < ns; n++) {
+        VNAME(load_be)(X[n], (off == NULL) ? (data + (n * VL)) : data,
+                       (off == NULL) ? NULL : (off + (n * VL)), sublen);
+        for (w = 0; w < 8; w++) {
+            S[w][n] = zero + iv[w];
+        }
+    }
+    for (blk = 0; blk < nblk; blk++) {
+        for (w = 0; w < 8; w++) {
+            for (n = 0; n < ns; n++) {
+                v[w][n] = S[w][n];
+            }
+        }
+        _Pragma("GCC unroll 64")
+        for (r = 0; r < 64; r++) {
+            _Pragma("GCC unroll 4")
+            for (n = 0; n < ns; n++) {
+                if (r < 16) {
+                    W[n][r] = X[n][blk * 16 + r].v;
+                }
+                else {
+                    s0 = W[n][(r + 1) & 15];
+                    s0 = ROTATE(s0, 25) ^ ROTATE(s0, 14) ^ (s0 >> 3);
+                    s1 = W[n][(r + 14) & 15];
+                    s1 = ROTATE(s1, 15) ^ ROTATE(s1, 13) ^ (s1 >> 10);
+                    W[n][r & 15] += s0 + W[n][(r + 9) & 15] + s1;
+                }
+                s1 = ROTATE(SV(4), 26) ^ ROTATE(SV(4), 21) ^ ROTATE(SV(4), 7);
+                t1 = SV(7) + s1 + (((SV(5) ^ SV(6)) & SV(4)) ^ SV(6)) + kt[r] + W[n][r & 15];
+                s0 = ROTATE(SV(0), 30) ^ ROTATE(SV(0), 19) ^ ROTATE(SV(0), 10);
+                t2 = s0 + ((SV(0) & SV(1)) | ((SV(0) | SV(1)) & SV(2)));
+                SV(3) += t1;
+                SV(7) = t1 + t2;
+            }
+        }
+        if (blk < nblk - 1) {
+            for (w = 0; w < 8; w++) {
+                for (n = 0; n < ns; n++) {
+                    S[w][n] += v[w][n];
+                }
+            }
+        }
+    }
+
+    /* After 64 rounds the names have come back round, so a is v[0] */
+    mask = 0;
+    for (n = 0; n < ns; n++) {
+        mask |= VNAME(check_a)(v[0][n], S[0][n], t) << (n * VL);
+    }
+    if (mask == 0) {
+        return(0);
+    }
+    for (w = 0; w < 8; w++) {
+        for (n = 0; n < ns; n++) {
+            S[w][n] += v[w][n];
+        }
+    }
+    return(VNAME(sha_store)(S, 8, ns, H, mask));
+}
+#undef SV
+
+
+/*
+ * The kernels.  Unlike MD5 there is one body per algorithm with the
+ * length known only at run time; the rounds do not depend on it, and
+ * a copy per length would not pay for its code size.
+ */
+static __attribute__((noinline))
+uint32_t VNAME(vsha1_run)(const char *data, const int32_t off[], uint32_t H[],
+                          const struct targetset *t, int sublen)
+{
+    if (sublen > MAXONEBLK) {
+        return(VNAME(vsha1_body)(data, off, H, t, sublen, 2));
+    }
+    return(VNAME(vsha1_body)(data, off, H, t, sublen, 1));
+}
+
+static __attribute__((noinline))
+uint32_t VNAME(vsha256_run)(const char *data, const int32_t off[], uint32_t H[],
+                            const struct targetset *t, int sublen)
+{
+    if (sublen > MAXONEBLK) {
+        return(VNAME(vsha256_body)(data, off, H, t, sublen, 2));
+    }
+    return(VNAME(vsha256_body)(data, off, H, t, sublen, 1));
+}
+
+static uint32_t VNAME(vsha1_gather)(const char *data, const int32_t off[], uint32_t H[],
+                                    const struct targetset *t, int sublen)
+{
+    return(VNAME(vsha1_run)(data, off, H, t, sublen));
+}
+
+static uint32_t VNAME(vsha256_gather)(const char *data, const int32_t off[], uint32_t H[],
+                                      const struct targetset *t, int sublen)
+{
+    return(VNAME(vsha256_run)(data, off, H, t, sublen));
+}
+
+    /* The vmd5fn kernels for each length just pass the length on */
+#define VSHA_LEN(n) \
+static uint32_t VNAME(vsha1_##n)(const char *data, uint32_t H[], \
+                                 const struct targetset *t) \
+{ \
+    return(VNAME(vsha1_run)(data, NULL, H, t, n)); \
+} \
+static uint32_t VNAME(vsha256_##n)(const char *data, uint32_t H[], \
+                                   const struct targetset *t) \
+{ \
+    return(VNAME(vsha256_run)(data, NULL, H, t, n)); \
+}
+
+VSHA_LEN(19) VSHA_LEN(20) VSHA_LEN(21) VSHA_LEN(22) VSHA_LEN(23)
+VSHA_LEN(24) VSHA_LEN(25) VSHA_LEN(26) VSHA_LEN(27) VSHA_LEN(28)
+VSHA_LEN(29) VSHA_LEN(30) VSHA_LEN(31) VSHA_LEN(32) VSHA_LEN(33)
+VSHA_LEN(34) VSHA_LEN(35) VSHA_LEN(36) VSHA_LEN(37) VSHA_LEN(38)
+VSHA_LEN(39) VSHA_LEN(40) VSHA_LEN(41) VSHA_LEN(42) VSHA_LEN(43)
+VSHA_LEN(44) VSHA_LEN(45) VSHA_LEN(46) VSHA_LEN(47) VSHA_LEN(48)
+VSHA_LEN(49) VSHA_LEN(50) VSHA_LEN(51) VSHA_LEN(52) VSHA_LEN(53)
+VSHA_LEN(54) VSHA_LEN(55) VSHA_LEN(56) VSHA_LEN(57) VSHA_LEN(58)
+VSHA_LEN(59) VSHA_LEN(60) VSHA_LEN(61) VSHA_LEN(62) VSHA_LEN(63)
+VSHA_LEN(64) VSHA_LEN(65) VSHA_LEN(66) VSHA_LEN(67) VSHA_LEN(68)
+VSHA_LEN(69) VSHA_LEN(70) VSHA_LEN(71) VSHA_LEN(72) VSHA_LEN(73)
+VSHA_LEN(74) VSHA_LEN(75) VSHA_LEN(76) VSHA_LEN(77) VSHA_LEN(78)
+VSHA_LEN(79) VSHA_LEN(80) VSHA_LEN(81) VSHA_LEN(82) VSHA_LEN(83)
+VSHA_LEN(84) VSHA_LEN(85) VSHA_LEN(86) VSHA_LEN(87) VSHA_LEN(88)
+VSHA_LEN(89) VSHA_LEN(90) VSHA_LEN(91) VSHA_LEN(92) VSHA_LEN(93)
+VSHA_LEN(94) VSHA_LEN(95) VSHA_LEN(96) VSHA_LEN(97) VSHA_LEN(98)
+VSHA_LEN(99) VSHA_LEN(100) VSHA_LEN(101) VSHA_LEN(102) VSHA_LEN(103)
+VSHA_LEN(104) VSHA_LEN(105) VSHA_LEN(106) VSHA_LEN(107) VSHA_LEN(108)
+VSHA_LEN(109) VSHA_LEN(110) VSHA_LEN(111) VSHA_LEN(112) VSHA_LEN(113)
+VSHA_LEN(114) VSHA_LEN(115) VSHA_LEN(116) VSHA_LEN(117) VSHA_LEN(118)
+VSHA_LEN(119)
+
+    /* kernels indexed by substring length */
+#define VSHA_TAB(h) { \
+    [19] = VNAME(h##_19), [20] = VNAME(h##_20), [21] = VNAME(h##_21), [22] = VNAME(h##_22), \
+    [23] = VNAME(h##_23), [24] = VNAME(h##_24), [25] = VNAME(h##_25), [26] = VNAME(h##_26), \
+    [27] = VNAME(h##_27), [28] = VNAME(h##_28), [29] = VNAME(h##_29), [30] = VNAME(h##_30), \
+    [31] = VNAME(h##_31), [32] = VNAME(h##_32), [33] = VNAME(h##_33), [34] = VNAME(h##_34), \
+    [35] = VNAME(h##_35), [36] = VNAME(h##_36), [37] = VNAME(h##_37), [38] = VNAME(h##_38), \
+    [39] = VNAME(h##_39), [40] = VNAME(h##_40), [41] = VNAME(h##_41), [42] = VNAME(h##_42), \
+    [43] = VNAME(h##_43), [44] = VNAME(h##_44), [45] = VNAME(h##_45), [46] = VNAME(h##_46), \
+    [47] = VNAME(h##_47), [48] = VNAME(h##_48), [49] = VNAME(h##_49), [50] = VNAME(h##_50), \
+    [51] = VNAME(h##_51), [52] = VNAME(h##_52), [53] = VNAME(h##_53), [54] = VNAME(h##_54), \
+    [55] = VNAME(h##_55), [56] = VNAME(h##_56), [57] = VNAME(h##_57), [58] = VNAME(h##_58), \
+    [59] = VNAME(h##_59), [60] = VNAME(h##_60), [61] = VNAME(h##_61), [62] = VNAME(h##_62), \
+    [63] = VNAME(h##_63), [64] = VNAME(h##_64), [65] = VNAME(h##_65), [66] = VNAME(h##_66), \
+    [67] = VNAME(h##_67), [68] = VNAME(h##_68), [69] = VNAME(h##_69), [70] = VNAME(h##_70), \
+    [71] = VNAME(h##_71), [72] = VNAME(h##_72), [73] = VNAME(h##_73), [74] = VNAME(h##_74), \
+    [75] = VNAME(h##_75), [76] = VNAME(h##_76), [77] = VNAME(h##_77), [78] = VNAME(h##_78), \
+    [79] = VNAME(h##_79), [80] = VNAME(h##_80), [81] = VNAME(h##_81), [82] = VNAME(h##_82), \
+    [83] = VNAME(h##_83), [84] = VNAME(h##_84), [85] = VNAME(h##_85), [86] = VNAME(h##_86), \
+    [87] = VNAME(h##_87), [88] = VNAME(h##_88), [89] = VNAME(h##_89), [90] = VNAME(h##_90), \
+    [91] = VNAME(h##_91), [92] = VNAME(h##_92), [93] = VNAME(h##_93), [94] = VNAME(h##_94), \
+    [95] = VNAME(h##_95), [96] = VNAME(h##_96), [97] = VNAME(h##_97), [98] = VNAME(h##_98), \
+    [99] = VNAME(h##_99), [100] = VNAME(h##_100), [101] = VNAME(h##_101), [102] = VNAME(h##_102), \
+    [103] = VNAME(h##_103), [104] = VNAME(h##_104), [105] = VNAME(h##_105), [106] = VNAME(h##_106), \
+    [107] = VNAME(h##_107), [108] = VNAME(h##_108), [109] = VNAME(h##_109), [110] = VNAME(h##_110), \
+    [111] = VNAME(h##_111), [112] = VNAME(h##_112), [113] = VNAME(h##_113), [114] = VNAME(h##_114), \
+    [115] = VNAME(h##_115), [116] = VNAME(h##_116), [117] = VNAME(h##_117), [118] = VNAME(h##_118), \
+    [119] = VNAME(h##_119), }
+
+static vmd5fn VNAME(Vsha1tab)[MAXSUBLEN + 1] = VSHA_TAB(vsha1);
+static vmd5fn VNAME(Vsha256tab)[MAXSUBLEN + 1] = VSHA_TAB(vsha256);
+
+#undef VSHA_TAB
+#undef VSHA_LEN